@@ -1,17 +1,29 @@
 #pragma once
 #include <map>
+#include <list>
+#include <mutex>
+#include <set>
 #include <regex>
 #include <future>
+#include <fstream>
+#include <semaphore>
 #include <ranges>
 #include <vector>
+#include <cstring>
 #include <numeric>
+#include <numbers>
+#include <algorithm>
+#include <functional>
 #include <filesystem>
 #include <opencv2/opencv.hpp>
+#include "ThreadPool.h"
+#include "PackedTileFile.h"
+#include "BuildTrace.h"
+#include "PixelFormat.h"
 
 // 用来存储地图图片区块以及对应的地图范围
 // 每个区块大小为 2048 * 2048
 // 能够根据范围获取地图图片区块
-// 加载图片均为实际 2048 * 2048 大小
 // 用于实现地图的缩放
 // 遍历./map/目录下的所有图片
 // 1_1.png 为(1,1)区块的图片
@@ -19,6 +31,17 @@
 // 2_1.png 为(2,1)区块的图片
 // 2_2.png 为(2,2)区块的图片
 // 以此类推
+//
+// 存储：区块按 2048 网格存放在稠密索引表中，查询由范围直接计算覆盖的网格。
+//       像素格式为模板参数（BlockMapResource 为 BGR），区块加载时一次转换为目标格式并归一化：
+//       单色区块只保存一个像素，边长能整除 2048 的区块保持原始分辨率，其余缩放到 2048。
+//       区块来源可以是图片目录，也可以是 save_packed 生成的打包文件，raw 编码区块直接使用映射内存。
+// 加载：eager 模式构造时读取全部区块；lazy 模式只建立索引，首次访问时解码，超出内存预算按 LRU 释放，
+//       启用预取后按各调用线程连续查询的移动方向在后台提前加载前方区块。
+// 查询：view 按区块合成，较大范围在共享线程池上并行；缩放查询使用按需生成的区块金字塔，
+//       旋转缩放查询按输出像素直接从区块采样；整图导出按条带流式写出，峰值内存约为一个条带。
+// 查询接口可以被多个线程并发调用，插入与加载等修改接口需要调用方保证独占访问。
+// 各阶段耗时与计数记录到 BuildTrace，未启用时几乎没有开销。
 
 // cv::Point less define
 namespace std
@@ -33,121 +56,938 @@ namespace std
     };
 } // namespace std
 
-class BlockMapResource
+template <typename Format>
+class BasicBlockMapResource
 {
 public:
-    BlockMapResource() = default;
-    BlockMapResource(const std::filesystem::path &path, std::string target_name, cv::Point map_origin, cv::Point origin_index)
-        : map_origin(map_origin), origin_index(origin_index)
+    using PixelFormat = Format;
+    // 区块与查询结果的图片类型
+    static constexpr int pixel_type = Format::type;
+    static constexpr int pixel_bytes = Format::channels;
+
+    // 区块加载模式
+    enum class LoadMode
+    {
+        eager, // 构造时读取全部区块图片
+        lazy   // 构造时只记录区块文件，首次访问时读取
+    };
+    // 默认延迟加载内存预算 512MB，约 40 个 2048 * 2048 BGR 区块，灰度区块约 128 个
+    static constexpr size_t default_cache_budget = 512ull * 1024 * 1024;
+    // 金字塔层数，第 0 层为原始 2048 分辨率，最后一层为 64
+    static constexpr int pyramid_levels = 6;
+    // 查询范围像素数达到该值时才按区块并行合成，较小的范围拆分的调度开销大于收益
+    static constexpr size_t parallel_threshold = 1024 * 1024;
+    // 只有不超过该像素数的查询参与移动预测，整图导出等大范围查询不是跟踪窗口
+    static constexpr size_t prefetch_max_pixels = 4096ull * 4096;
+
+public:
+    BasicBlockMapResource() = default;
+    BasicBlockMapResource(const std::filesystem::path &path, std::string target_name, cv::Point map_origin, cv::Point origin_index, LoadMode mode = LoadMode::eager, size_t cache_budget = default_cache_budget)
+        : map_origin(map_origin), origin_index(origin_index), cache_budget(cache_budget)
     {
         if (std::filesystem::exists(path) == false)
             return; // 文件夹不存在
 
-        std::vector<std::pair<std::string, cv::Point>> target_files;
-        for (auto &p : std::filesystem::directory_iterator(path))
+        auto target_files = scan(path, target_name);
+        if (mode == LoadMode::lazy)
         {
-            auto result = parse_file_name(p.path().filename().string(), target_name);
-            if (result == std::nullopt)
-                continue;
-            auto &[name, xy] = result.value();
-            cv::Mat img = cv::imread((path / name).string());
-            insert(size_normalize(img), xy);
+            for (auto &[file, xy] : target_files)
+                insert(file, xy);
         }
-        if (blocks.find(origin_index) == blocks.end())
+        else
+            ingest(target_files);
+        auto origin_block = find_block(origin_index);
+        if (origin_block == nullptr)
             return; // 原点图片不存在
-        origin = blocks[origin_index].rect.tl() + cv::Point(1024, 1024);
+        origin = origin_block->rect.tl() + cv::Point(1024, 1024);
     }
-    ~BlockMapResource() = default;
+    // 从打包区块文件映射加载
+    // raw 编码的区块直接在映射内存上构造 Mat，由系统按页换入；png 编码的区块按延迟加载区块处理
+    // 映射随对象释放，view_ref 返回的引用不能比对象存活更久
+    // 文件中的区块通道数与目标格式不一致时全部按 png 方式解码转换，不能直接映射
+    explicit BasicBlockMapResource(const std::filesystem::path &pack_file, size_t cache_budget = default_cache_budget)
+        : cache_budget(cache_budget)
+    {
+        auto file = std::make_shared<MappedFile>(pack_file);
+        if (file->data() == nullptr || file->size() < sizeof(PackedTileHeader))
+            return; // 文件不存在或为空
+        PackedTileHeader header;
+        std::memcpy(&header, file->data(), sizeof(header));
+        if (header.is_valid() == false || header.tile_size != 2048)
+            return; // 文件格式不匹配
+        if (header.entry_offset + header.tile_count * sizeof(PackedTileEntry) > file->size())
+            return; // 文件损坏
+        map_origin = cv::Point(header.map_origin_x, header.map_origin_y);
+        origin_index = cv::Point(header.origin_index_x, header.origin_index_y);
+        auto entries = reinterpret_cast<const PackedTileEntry *>(file->data() + header.entry_offset);
+        for (uint32_t i = 0; i < header.tile_count; i++)
+        {
+            auto &entry = entries[i];
+            if (entry.offset + entry.size > file->size())
+                continue; // 区块数据越界
+            cv::Point index(entry.index_x, entry.index_y);
+            auto data = const_cast<uchar *>(file->data() + entry.offset);
+            int channels = static_cast<int>(header.channels);
+            if (entry.encoding == PackedTileEncoding::raw && entry.size == 2048ull * 2048 * channels && (channels == 1 || channels == 3 || channels == 4))
+            {
+                cv::Mat image(2048, 2048, CV_8UC(channels), data);
+                if (channels == Format::channels)
+                    insert(image, index);
+                else
+                    insert_block({index, cv::Mat(), block_rect(index), [image]
+                                  { return image; }});
+            }
+            else if (entry.encoding == PackedTileEncoding::png)
+                insert_block({index, cv::Mat(), block_rect(index), [data, size = entry.size]
+                              { return cv::imdecode(cv::Mat(1, static_cast<int>(size), CV_8UC1, data), Format::imread_flags); }});
+        }
+        mapped = file;
+        auto origin_block = find_block(origin_index);
+        if (origin_block == nullptr)
+            return; // 原点图片不存在
+        origin = origin_block->rect.tl() + cv::Point(1024, 1024);
+    }
+    // 先停止预取线程，后台任务引用的区块与缓存状态在此之后才释放
+    ~BasicBlockMapResource() { prefetcher.stop(); }
+    BasicBlockMapResource(BasicBlockMapResource &&) = default;
+    BasicBlockMapResource &operator=(BasicBlockMapResource &&) = default;
 
 public:
     void set_origin_index(cv::Point origin_index)
     {
-        origin_index = origin_index;
-        origin = blocks[origin_index].rect.tl() + cv::Point(1024, 1024);
+        auto origin_block = find_block(origin_index);
+        if (origin_block == nullptr)
+            return; // 原点图片不存在
+        this->origin_index = origin_index;
+        origin = origin_block->rect.tl() + cv::Point(1024, 1024);
+    }
+    void set_map_origin(cv::Point map_origin) { this->map_origin = map_origin; }
+    cv::Point get_abs_origin() const { return abs_origin(); }
+    cv::Rect get_min_rect() const { return min_rect; }
+    // 区块数量
+    size_t size() const { return blocks.size(); }
+    // 全部区块的范围，以图片左上角绝对坐标系
+    std::vector<cv::Rect> get_block_rects() const
+    {
+        std::vector<cv::Rect> rects;
+        rects.reserve(blocks.size());
+        for (auto &block : blocks)
+            rects.push_back(block.rect);
+        return rects;
+    }
+    // 设置延迟加载区块的内存预算，单位字节
+    void set_cache_budget(size_t budget)
+    {
+        std::lock_guard<std::mutex> lock(*cache_mutex);
+        cache_budget = budget;
+        evict();
+    }
+    size_t get_cache_budget() const { return cache_budget; }
+    // 当前已加载的延迟加载区块占用的内存，单位字节
+    size_t get_cache_bytes() const
+    {
+        std::lock_guard<std::mutex> lock(*cache_mutex);
+        return cache_bytes;
+    }
+    // 启用或关闭运动预测预取
+    // 连续的 view 查询按中心点估计移动速度，沿移动方向至少 distance 像素、至多 steps 次查询的位移范围内
+    // 尚未加载的区块在后台线程读取解码，缩放查询同时生成对应的金字塔层
+    // 预取的区块与普通加载一样计入内存预算，预算应能容纳当前窗口与前方的区块
+    // 移动状态按调用线程分别记录，多个追踪线程并发查询时互不干扰；同一追踪过程应在同一线程中查询
+    void set_prefetch(bool enable, int distance = 512, int steps = 16)
+    {
+        prefetcher.stop();
+        prefetcher.distance = std::max(distance, 0);
+        prefetcher.steps = std::max(steps, 1);
+        prefetcher.enabled = enable;
     }
-    void set_map_origin(cv::Point map_origin) { map_origin = map_origin; }
-    cv::Point get_abs_origin() { return abs_origin(); }
-    cv::Rect get_min_rect() { return min_rect; }
+    bool get_prefetch() const { return prefetcher.enabled; }
 
 public:
-    void load(const std::filesystem::path &path, std::string target_name, cv::Point map_origin, cv::Point origin_index)
+    // 列出目录下属于目标地图的区块文件及其索引，不读取文件内容
+    static std::vector<std::pair<std::filesystem::path, cv::Point>> scan(const std::filesystem::path &path, const std::string &target_name)
     {
-        *this = BlockMapResource(path, target_name, map_origin, origin_index);
+        TraceScope scope("scan", "tiles");
+        std::vector<std::pair<std::filesystem::path, cv::Point>> target_files;
+        if (std::filesystem::exists(path) == false)
+            return target_files;
+        std::regex reg("UI_" + target_name + "_(-?\\d+)_(-?\\d+).png");
+        for (auto &p : std::filesystem::directory_iterator(path))
+        {
+            auto result = parse_file_name(p.path().filename().string(), reg);
+            if (result == std::nullopt)
+                continue;
+            auto &[name, xy] = result.value();
+            target_files.emplace_back(path / name, xy);
+        }
+        scope.items(static_cast<int64_t>(target_files.size()));
+        return target_files;
+    }
+    // 区块索引对应的范围，以图片左上角绝对坐标系
+    static cv::Rect get_block_rect(const cv::Point &index) { return block_rect(index); }
+    void load(const std::filesystem::path &path, std::string target_name, cv::Point map_origin, cv::Point origin_index, LoadMode mode = LoadMode::eager, size_t cache_budget = default_cache_budget)
+    {
+        *this = BasicBlockMapResource(path, target_name, map_origin, origin_index, mode, cache_budget);
+    }
+    void load(const std::filesystem::path &pack_file, size_t cache_budget = default_cache_budget)
+    {
+        *this = BasicBlockMapResource(pack_file, cache_budget);
     }
+    // 通道数与目标格式不一致的图片在插入时转换
     void insert(const cv::Mat &image, const cv::Point &index)
     {
-        blocks.insert({index, {index, image, cv::Rect((-index.y - 1) * 2048, (-index.x - 1) * 2048, 2048, 2048)}});
-        min_rect = gen_bounding_rect();
+        insert_block({index, compact(convert_pixel_format<Format>(image)), block_rect(index)});
+    }
+    // 插入延迟加载区块，只记录文件路径
+    void insert(const std::filesystem::path &file, const cv::Point &index)
+    {
+        insert_block({index, cv::Mat(), block_rect(index), [file]
+                      { return cv::imread(file.string(), Format::imread_flags); }});
+    }
+    // 批量并行加载区块
+    // 读取文件、解码、尺寸归一化按区块流水线执行：当前线程顺序读取文件字节，线程池并行解码和归一化
+    // 全部完成后统一计算一次包围矩形
+    void ingest(const std::vector<std::pair<std::filesystem::path, cv::Point>> &files, size_t thread_count = std::thread::hardware_concurrency())
+    {
+        if (files.empty())
+            return;
+        TraceScope scope("ingest", "tiles");
+        scope.items(static_cast<int64_t>(files.size()));
+        auto worker_count = std::min<size_t>(std::max<size_t>(thread_count, 1), files.size());
+        // 限制已读取但未解码的文件数量，避免读取阶段领先过多占用内存
+        // 信号量先于线程池声明，异常退出时线程池先等待排队任务执行完，任务释放信号量时它仍然有效
+        std::counting_semaphore<> in_flight(static_cast<std::ptrdiff_t>(worker_count * 2));
+        ThreadPool pool(worker_count);
+        std::vector<std::future<cv::Mat>> images;
+        images.reserve(files.size());
+        for (auto &[file, index] : files)
+        {
+            in_flight.acquire();
+            auto bytes = read_file(file);
+            images.push_back(pool.submit([bytes = std::move(bytes), &in_flight]() mutable
+                                         {
+                                             cv::Mat img;
+                                             if (bytes.empty() == false)
+                                             {
+                                                 TraceScope decode_scope("decode", "tiles");
+                                                 decode_scope.bytes(static_cast<int64_t>(bytes.size()));
+                                                 img = convert_pixel_format<Format>(cv::imdecode(bytes, Format::imread_flags));
+                                                 BuildTrace::add(TraceCounter::tiles_decoded);
+                                             }
+                                             std::vector<uchar>().swap(bytes);
+                                             in_flight.release();
+                                             if (img.empty())
+                                                 return img; // 读取或解码失败的区块跳过
+                                             return compact(img); }));
+        }
+        for (size_t i = 0; i < files.size(); i++)
+        {
+            cv::Mat image = images[i].get();
+            if (image.empty())
+                continue;
+            auto &index = files[i].second;
+            insert_block({index, image, block_rect(index)});
+        }
     }
 
     // 获取地图图片
-    cv::Mat view() { return view_abs(gen_bounding_rect()); }
+    cv::Mat view() const { return view_abs(gen_bounding_rect()); }
     // 获取地图局部，以地图原点坐标系
-    cv::Mat view(const cv::Rect &rect) { return view(rect, find_indexs(rect)); }
+    cv::Mat view(const cv::Rect &rect) const { return view_abs(to_abs(rect)); }
     // 获取地图局部，以图片左上角绝对坐标系
-    cv::Mat view_abs(const cv::Rect &rect) { return view_abs(rect, find_indexs_abs(rect)); }
+    cv::Mat view_abs(const cv::Rect &rect) const
+    {
+        cv::Mat map;
+        view_abs_into(rect, map);
+        return map;
+    }
 
-private:
-    cv::Mat view(const cv::Rect &rect, const std::vector<cv::Point> index_s)
+    // 获取地图局部的只读引用，以地图原点坐标系
+    // 范围完全落在单个区块内时直接返回区块图片的 ROI，不分配也不拷贝，否则退化为 view
+    // 返回的 Mat 与区块共享数据，不要写入，也不要作为 view_into 的输出缓冲区
+    cv::Mat view_ref(const cv::Rect &rect) const { return view_abs_ref(to_abs(rect)); }
+    // 获取地图局部的只读引用，以图片左上角绝对坐标系
+    cv::Mat view_abs_ref(const cv::Rect &rect) const
     {
-        return view_abs(to_abs(rect), index_s);
+        if (rect.area() <= 0)
+            return view_abs(rect);
+        cv::Point cell(floor_div(rect.x, 2048), floor_div(rect.y, 2048));
+        if (floor_div(rect.x + rect.width - 1, 2048) != cell.x || floor_div(rect.y + rect.height - 1, 2048) != cell.y)
+            return view_abs(rect);
+        auto block = find_block_cell(cell);
+        if (block == nullptr)
+            return view_abs(rect);
+        cv::Mat image = acquire(*block);
+        // 原始分辨率不是 2048 的区块需要缩放，无法直接引用；view_abs 会自行记录移动，这里只在直接引用时记录一次
+        if (image.cols != 2048 || image.rows != 2048)
+            return view_abs(rect);
+        observe(rect, 0);
+        return image(rect - block->rect.tl());
     }
 
-    cv::Mat view_abs(const cv::Rect &rect, const std::vector<cv::Point> index_s)
+    // 保存为打包区块文件，区块按网格 Morton 顺序排列，空间相邻的区块在文件中也相邻
+    // 延迟加载模式下逐个区块读取写出，内存占用受预算约束
+    bool save_packed(const std::filesystem::path &pack_file, PackedTileEncoding encoding = PackedTileEncoding::raw) const
     {
-        cv::Mat map = cv::Mat::zeros(rect.size(), CV_8UC3);
-        for (auto &index : index_s)
-            map = view_abs(rect, index, map);
-        return map;
+        std::vector<size_t> order(blocks.size());
+        std::iota(order.begin(), order.end(), 0);
+        auto key = [&](size_t i)
+        {
+            auto cell = block_cell(blocks[i].index) - grid_rect.tl();
+            return morton_code(static_cast<uint32_t>(cell.x), static_cast<uint32_t>(cell.y));
+        };
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                  { return key(a) < key(b); });
+
+        std::ofstream out(pack_file, std::ios::binary | std::ios::trunc);
+        if (out.is_open() == false)
+            return false;
+        TraceScope scope("save_packed", "export");
+        scope.items(static_cast<int64_t>(blocks.size()));
+        PackedTileHeader header;
+        header.channels = static_cast<uint32_t>(Format::channels);
+        header.tile_count = static_cast<uint32_t>(blocks.size());
+        header.map_origin_x = map_origin.x;
+        header.map_origin_y = map_origin.y;
+        header.origin_index_x = origin_index.x;
+        header.origin_index_y = origin_index.y;
+        std::vector<PackedTileEntry> entries(blocks.size());
+        // 先写文件头与占位索引，区块写完后回填索引
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(entries.data()), static_cast<std::streamsize>(entries.size() * sizeof(PackedTileEntry)));
+        uint64_t offset = sizeof(header) + entries.size() * sizeof(PackedTileEntry);
+        std::vector<uchar> buffer;
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            auto &block = blocks[order[i]];
+            cv::Mat image = acquire(block);
+            // raw 编码需要完整的 2048 区块以便直接映射，png 编码保留原始分辨率
+            if (encoding == PackedTileEncoding::raw && (image.cols != 2048 || image.rows != 2048))
+            {
+                cv::Mat full(2048, 2048, pixel_type);
+                blit(image, cv::Rect(0, 0, 2048, 2048), full);
+                image = full;
+            }
+            if (encoding == PackedTileEncoding::png)
+                cv::imencode(".png", image, buffer, {cv::IMWRITE_PNG_COMPRESSION, 1});
+            uint64_t aligned = (offset + packed_tile_alignment - 1) / packed_tile_alignment * packed_tile_alignment;
+            out.write(std::string(aligned - offset, '\0').data(), static_cast<std::streamsize>(aligned - offset));
+            auto &entry = entries[i];
+            entry.index_x = block.index.x;
+            entry.index_y = block.index.y;
+            entry.encoding = encoding;
+            entry.offset = aligned;
+            if (encoding == PackedTileEncoding::png)
+            {
+                entry.size = buffer.size();
+                out.write(reinterpret_cast<const char *>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+            }
+            else
+            {
+                entry.size = image.total() * image.elemSize();
+                for (int row = 0; row < image.rows; row++)
+                    out.write(reinterpret_cast<const char *>(image.ptr(row)), static_cast<std::streamsize>(image.cols * image.elemSize()));
+            }
+            offset = aligned + entry.size;
+        }
+        scope.bytes(static_cast<int64_t>(offset));
+        out.seekp(static_cast<std::streamoff>(header.entry_offset));
+        out.write(reinterpret_cast<const char *>(entries.data()), static_cast<std::streamsize>(entries.size() * sizeof(PackedTileEntry)));
+        return out.good();
     }
 
-    cv::Mat view_abs(const cv::Rect &rect, const cv::Point index, cv::Mat map = cv::Mat())
+    // 获取缩放后的地图局部，以地图原点坐标系，rect 为原始分辨率下的范围
+    // 输出尺寸为 rect 尺寸乘以 scale，从分辨率不低于 scale 的最近金字塔层逐区块缩放到输出，不合成原始分辨率的整图
+    cv::Mat view_scaled(const cv::Rect &rect, double scale, int interpolation = cv::INTER_AREA) const { return view_abs_scaled(to_abs(rect), scale, interpolation); }
+    // 获取缩放后的地图局部，以图片左上角绝对坐标系
+    cv::Mat view_abs_scaled(const cv::Rect &rect, double scale, int interpolation = cv::INTER_AREA) const
     {
-        if (map.empty())
-            map = cv::Mat::zeros(rect.size(), CV_8UC3);
-        cv::Rect r = rect & blocks[index].rect;
-        // 如果交集面积为0，直接返回
-        if (r.area() == 0)
-            return map;
-        // 获取相对于地图图片的范围
-        cv::Rect r1 = r - blocks[index].rect.tl();
-        // 获取相对于区块图片的范围
-        cv::Rect r2 = r - rect.tl();
-        blocks[index].image(r1).copyTo(map(r2));
+        if (rect.area() <= 0 || scale <= 0)
+            return cv::Mat();
+        TraceScope scope("view_scaled", "view");
+        observe(rect, pyramid_level(scale));
+        cv::Mat map;
+        create_output(map, cv::Size(std::max(1, static_cast<int>(std::lround(rect.width * scale))), std::max(1, static_cast<int>(std::lround(rect.height * scale)))));
+        // 原始坐标到输出坐标的映射，相邻区块共用取整后的边界，避免缝隙
+        auto to_map_x = [&](int x)
+        { return std::clamp(static_cast<int>(std::lround((x - rect.x) * scale)), 0, map.cols); };
+        auto to_map_y = [&](int y)
+        { return std::clamp(static_cast<int>(std::lround((y - rect.y) * scale)), 0, map.rows); };
+        int level = pyramid_level(scale);
+        for_each_cell(rect, static_cast<size_t>(map.rows) * map.cols, [&](const cv::Point &cell, const cv::Rect &r)
+                      {
+                          cv::Rect r2(cv::Point(to_map_x(r.x), to_map_y(r.y)), cv::Point(to_map_x(r.br().x), to_map_y(r.br().y)));
+                          if (r2.area() <= 0)
+                              return;
+                          cv::Mat dst = map(r2);
+                          auto block = find_block_cell(cell);
+                          if (block == nullptr)
+                          {
+                              dst.setTo(cv::Scalar::all(0));
+                              return;
+                          }
+                          cv::Mat image = acquire(*block, level);
+                          if (image.total() == 1)
+                          {
+                              dst.setTo(cv::mean(image));
+                              return;
+                          }
+                          // 获取相对于金字塔层区块图片的范围，向外取整，原始分辨率的区块按比例换算
+                          double sx = image.cols / 2048.0, sy = image.rows / 2048.0;
+                          cv::Rect r1 = r - block->rect.tl();
+                          r1 = cv::Rect(cv::Point(static_cast<int>(std::floor(r1.x * sx)), static_cast<int>(std::floor(r1.y * sy))),
+                                        cv::Point(static_cast<int>(std::ceil(r1.br().x * sx)), static_cast<int>(std::ceil(r1.br().y * sy)))) &
+                               cv::Rect(0, 0, image.cols, image.rows);
+                          cv::resize(image(r1), dst, dst.size(), 0, 0, interpolation); });
+        scope.bytes(static_cast<int64_t>(map.total() * map.elemSize()));
         return map;
     }
+    // 获取旋转缩放后的地图局部，以地图原点坐标系
+    // 输出中心对应 center，scale 为输出像素与原始像素的比例，angle 为角度，与 cv::getRotationMatrix2D 相同，正值使画面逆时针旋转
+    // 每个输出像素直接从分辨率不低于 scale 的最近金字塔层采样，interpolation 支持 INTER_NEAREST 与 INTER_LINEAR
+    cv::Mat view_transformed(const cv::Point2d &center, double angle, double scale, const cv::Size &out_size, int interpolation = cv::INTER_LINEAR) const
+    {
+        cv::Mat out;
+        view_abs_transformed_into(center + cv::Point2d(abs_origin()), angle, scale, out_size, out, interpolation);
+        return out;
+    }
+    // 获取旋转缩放后的地图局部，以图片左上角绝对坐标系
+    cv::Mat view_abs_transformed(const cv::Point2d &center, double angle, double scale, const cv::Size &out_size, int interpolation = cv::INTER_LINEAR) const
+    {
+        cv::Mat out;
+        view_abs_transformed_into(center, angle, scale, out_size, out, interpolation);
+        return out;
+    }
+    // 获取旋转缩放后的地图局部到调用方的缓冲区，以地图原点坐标系，out 的尺寸与类型一致时复用其内存
+    void view_transformed_into(const cv::Point2d &center, double angle, double scale, const cv::Size &out_size, cv::Mat &out, int interpolation = cv::INTER_LINEAR) const
+    {
+        view_abs_transformed_into(center + cv::Point2d(abs_origin()), angle, scale, out_size, out, interpolation);
+    }
+    // 获取旋转缩放后的地图局部到调用方的缓冲区，以图片左上角绝对坐标系
+    void view_abs_transformed_into(const cv::Point2d &center, double angle, double scale, const cv::Size &out_size, cv::Mat &out, int interpolation = cv::INTER_LINEAR) const
+    {
+        create_output(out, out_size);
+        if (out_size.area() <= 0)
+            return;
+        if (scale <= 0)
+        {
+            out.setTo(cv::Scalar::all(0));
+            return;
+        }
+        TraceScope scope("view_transformed", "view");
+        scope.bytes(static_cast<int64_t>(out.total() * out.elemSize()));
+        double radian = angle * std::numbers::pi / 180.0;
+        double a = std::cos(radian) / scale, b = std::sin(radian) / scale;
+        // 输出像素 (u, v) 的中心对应的源坐标为 origin + du * u + dv * v
+        cv::Point2d du(a, b), dv(-b, a);
+        cv::Point2d origin = center + du * (0.5 - out_size.width / 2.0) + dv * (0.5 - out_size.height / 2.0);
+        // 源范围的包围矩形，用于移动预测
+        cv::Point2d corners[] = {origin, origin + du * out_size.width, origin + dv * out_size.height, origin + du * out_size.width + dv * out_size.height};
+        cv::Point2d lo = corners[0], hi = corners[0];
+        for (auto &c : corners)
+        {
+            lo = cv::Point2d(std::min(lo.x, c.x), std::min(lo.y, c.y));
+            hi = cv::Point2d(std::max(hi.x, c.x), std::max(hi.y, c.y));
+        }
+        int level = pyramid_level(scale);
+        observe(cv::Rect(cv::Point(static_cast<int>(std::floor(lo.x)), static_cast<int>(std::floor(lo.y))), cv::Point(static_cast<int>(std::ceil(hi.x)), static_cast<int>(std::ceil(hi.y)))), level);
+        // 按 16 行一组划分，输出像素数达到 parallel_threshold 时在共享线程池上并行采样
+        constexpr int rows_per_task = 16;
+        size_t count = static_cast<size_t>((out.rows + rows_per_task - 1) / rows_per_task);
+        auto run = [&](size_t i)
+        {
+            int begin = static_cast<int>(i) * rows_per_task;
+            int end = std::min(out.rows, begin + rows_per_task);
+            if (interpolation == cv::INTER_NEAREST)
+                sample_rows<false>(out, origin, du, dv, level, begin, end);
+            else
+                sample_rows<true>(out, origin, du, dv, level, begin, end);
+        };
+        if (count > 1 && out.total() >= parallel_threshold)
+            shared_pool().parallel_for(count, run);
+        else
+            for (size_t i = 0; i < count; i++)
+                run(i);
+    }
 
-    cv::Mat view_async(const cv::Rect &rect, const std::vector<cv::Point> index_s)
+    // 预先生成全部区块的金字塔层，延迟加载模式下仍受内存预算约束
+    void build_pyramid() const
     {
-        cv::Mat map = cv::Mat::zeros(rect.size(), CV_8UC3);
-        std::list<std::future<void>> futures;
-        for (auto &index : index_s)
+        for (auto &block : blocks)
+            acquire(block, pyramid_levels - 1);
+    }
+
+    // 按条带遍历整张地图，条带边界与 strip_height 网格对齐，缓冲区在条带间复用，峰值内存约为一个条带
+    // fn(strip, y)：strip 为条带图片，可以被回调修改，y 为条带在整图中的起始行
+    void for_each_strip(const std::function<void(cv::Mat &, int)> &fn, int strip_height = 2048) const
+    {
+        strip_height = std::max(1, strip_height);
+        cv::Rect rect = gen_bounding_rect();
+        cv::Mat strip;
+        for (int y = rect.y; y < rect.y + rect.height;)
         {
-            cv::Rect r = rect & blocks[index].rect;
-            if (r.area() == 0)
-                continue;
-            cv::Rect r1 = r - blocks[index].rect.tl();
-            cv::Rect r2 = r - rect.tl();
-            futures.emplace_back(std::async(std::launch::async, [r1, r2, index, this, &map]
-                                            { blocks[index].image(r1).copyTo(map(r2)); }));
+            int next = std::min(rect.y + rect.height, (floor_div(y, strip_height) + 1) * strip_height);
+            view_abs_into(cv::Rect(rect.x, y, rect.width, next - y), strip);
+            fn(strip, y - rect.y);
+            y = next;
         }
-        for (auto &f : futures)
-            f.get();
-        return map;
+    }
+    // 以二进制 PPM 格式流式导出整张地图，不需要合成整图，灰度格式导出为 PGM
+    bool export_ppm(const std::filesystem::path &file, int strip_height = 2048) const
+    {
+        std::ofstream out(file, std::ios::binary | std::ios::trunc);
+        if (out.is_open() == false)
+            return false;
+        TraceScope scope("export_ppm", "export");
+        cv::Rect rect = gen_bounding_rect();
+        constexpr int out_channels = Format::channels == 1 ? 1 : 3;
+        scope.bytes(static_cast<int64_t>(rect.area()) * out_channels);
+        out << (out_channels == 1 ? "P5\n" : "P6\n")
+            << rect.width << " " << rect.height << "\n255\n";
+        cv::Mat rgb;
+        for_each_strip([&](cv::Mat &strip, int)
+                       {
+                           if constexpr (Format::channels == 1)
+                               rgb = strip;
+                           else
+                               cv::cvtColor(strip, rgb, Format::channels == 4 ? cv::COLOR_BGRA2RGB : cv::COLOR_BGR2RGB);
+                           for (int row = 0; row < rgb.rows; row++)
+                               out.write(reinterpret_cast<const char *>(rgb.ptr(row)), static_cast<std::streamsize>(rgb.cols) * out_channels); },
+                       strip_height);
+        return out.good();
+    }
+    // 按条带导出为多张 PNG，文件名为 <prefix>_<条带序号>.png，条带自上而下排列
+    bool export_strips(const std::filesystem::path &directory, const std::string &prefix, int strip_height = 2048) const
+    {
+        bool success = true;
+        int strip_index = 0;
+        for_each_strip([&](cv::Mat &strip, int)
+                       { success = cv::imwrite((directory / (prefix + "_" + std::to_string(strip_index++) + ".png")).string(), strip) && success; },
+                       strip_height);
+        return success;
+    }
+
+    // 获取地图局部到调用方的缓冲区，以地图原点坐标系
+    // out 的尺寸与类型一致时复用其内存，只清零没有区块覆盖的部分
+    // 需要行对齐的格式新分配的 out 为按对齐宽度分配的缓冲区的 ROI
+    void view_into(const cv::Rect &rect, cv::Mat &out) const { view_abs_into(to_abs(rect), out); }
+    // 获取地图局部到调用方的缓冲区，以图片左上角绝对坐标系
+    void view_abs_into(const cv::Rect &rect, cv::Mat &out) const
+    {
+        create_output(out, rect.size());
+        if (rect.area() <= 0)
+            return;
+        TraceScope scope("view", "view");
+        scope.bytes(static_cast<int64_t>(out.total() * out.elemSize()));
+        observe(rect, 0);
+        // 区块按网格对齐，逐个遍历范围覆盖的网格单元：存在区块的拷贝，空缺的清零
+        // 各单元写入输出的不同区域，可以并行处理
+        for_each_cell(rect, static_cast<size_t>(rect.width) * rect.height, [&](const cv::Point &cell, const cv::Rect &r)
+                      {
+                          // 获取相对于输出图片的范围
+                          cv::Rect r2 = r - rect.tl();
+                          auto block = find_block_cell(cell);
+                          if (block == nullptr)
+                          {
+                              out(r2).setTo(cv::Scalar::all(0));
+                              return;
+                          }
+                          // 获取相对于区块图片的范围
+                          cv::Rect r1 = r - block->rect.tl();
+                          blit(acquire(*block), r1, out(r2)); });
+    }
+
+private:
+    // 分配输出图片，尺寸与类型一致时复用
+    // 有行对齐要求的格式按对齐后的宽度分配，返回其中的 ROI，每行起始地址都满足对齐
+    static void create_output(cv::Mat &out, const cv::Size &size)
+    {
+        if (out.size() == size && out.type() == pixel_type)
+            return;
+        if constexpr (Format::row_alignment > 0)
+        {
+            size_t row_bytes = (static_cast<size_t>(size.width) * pixel_bytes + Format::row_alignment - 1) / Format::row_alignment * Format::row_alignment;
+            cv::Mat buffer(size.height, static_cast<int>(row_bytes / pixel_bytes), pixel_type);
+            out = buffer(cv::Rect(0, 0, size.width, size.height));
+        }
+        else
+            out.create(size, pixel_type);
+    }
+    // 遍历范围覆盖的网格单元，r 为单元与范围的交集
+    // 输出像素数达到 parallel_threshold 且覆盖多个单元时在共享线程池上并行处理
+    template <typename F>
+    void for_each_cell(const cv::Rect &rect, size_t pixels, F &&fn) const
+    {
+        cv::Point first(floor_div(rect.x, 2048), floor_div(rect.y, 2048));
+        cv::Point last(floor_div(rect.x + rect.width - 1, 2048), floor_div(rect.y + rect.height - 1, 2048));
+        size_t cols = static_cast<size_t>(last.x - first.x + 1);
+        size_t count = cols * static_cast<size_t>(last.y - first.y + 1);
+        auto run = [&](size_t i)
+        {
+            cv::Point cell(first.x + static_cast<int>(i % cols), first.y + static_cast<int>(i / cols));
+            fn(cell, rect & cv::Rect(cell.x * 2048, cell.y * 2048, 2048, 2048));
+        };
+        if (count > 1 && pixels >= parallel_threshold)
+            shared_pool().parallel_for(count, run);
+        else
+            for (size_t i = 0; i < count; i++)
+                run(i);
     }
 
-    // 图片大小归一化
-    cv::Mat size_normalize(cv::Mat &img)
+    struct Block;
+    // 获取区块图片，延迟加载区块在此读取并更新 LRU 顺序
+    // 缓存状态均为 mutable 并由 cache_mutex 保护，查询接口保持 const 且可并发调用
+    // 返回的 Mat 持有引用计数，即使随后被淘汰也可以安全使用
+    cv::Mat acquire(const Block &block) const
     {
-        if (img.cols != 2048 || img.rows != 2048)
-            // 为了防止边缘出现淡化现象，放大时使用 INTER_NEAREST 插值
-            cv ::resize(img, img, cv::Size(2048, 2048), 0, 0, (img.cols > 512 || img.rows > 512) ? cv::INTER_NEAREST : cv::INTER_CUBIC);
+        // 常驻区块加载后不再修改，无需加锁
+        if (block.loader == nullptr)
+            return block.image;
+        {
+            // 其他线程（包括预取线程）正在加载同一区块时等待其结果，不重复解码
+            std::unique_lock<std::mutex> lock(*cache_mutex);
+            cache_condition->wait(lock, [&]
+                                  { return block.loading == false; });
+            if (block.image.empty() == false)
+            {
+                lru.splice(lru.begin(), lru, block.lru);
+                BuildTrace::add(TraceCounter::cache_hits);
+                return block.image;
+            }
+            block.loading = true;
+        }
+        // 解码抛出异常时也要清除加载标记并唤醒等待者，否则之后获取该区块的线程会一直等待
+        struct LoadingGuard
+        {
+            const Block &block;
+            std::mutex &mutex;
+            std::condition_variable &condition;
+            bool active = true;
+            ~LoadingGuard()
+            {
+                if (active == false)
+                    return;
+                std::lock_guard<std::mutex> lock(mutex);
+                block.loading = false;
+                condition.notify_all();
+            }
+        } guard{block, *cache_mutex, *cache_condition};
+        BuildTrace::add(TraceCounter::cache_misses);
+        // 在锁外解码，不同线程可以同时加载不同区块
+        cv::Mat img;
+        {
+            TraceScope scope("load", "tiles");
+            img = convert_pixel_format<Format>(block.loader());
+            if (img.empty())
+                img = cv::Mat::zeros(1, 1, pixel_type); // 图片损坏时按空白区块处理
+            img = compact(img);
+            scope.bytes(static_cast<int64_t>(img.total() * img.elemSize()));
+            BuildTrace::add(TraceCounter::tiles_decoded);
+        }
+        std::lock_guard<std::mutex> lock(*cache_mutex);
+        guard.active = false;
+        block.loading = false;
+        cache_condition->notify_all();
+        block.image = img;
+        cache_bytes += img.total() * img.elemSize();
+        lru.push_front(static_cast<size_t>(&block - blocks.data()));
+        block.lru = lru.begin();
+        evict();
+        BuildTrace::sample("cache_bytes", static_cast<int64_t>(cache_bytes));
         return img;
     }
+    // 获取区块第 level 层金字塔图片，每层由上一层 2x2 区域平均生成
+    // 原始分辨率已不高于该层边长的区块直接返回原始图片
+    cv::Mat acquire(const Block &block, int level) const
+    {
+        // 先获取原始图片，保证区块已加载并更新 LRU 顺序
+        cv::Mat image = acquire(block);
+        if (level == 0 || (image.cols <= (2048 >> level) && image.rows <= (2048 >> level)))
+            return image;
+        {
+            std::lock_guard<std::mutex> lock(*cache_mutex);
+            if (block.levels.size() >= static_cast<size_t>(level) && block.levels[level - 1].empty() == false)
+                return block.levels[level - 1];
+        }
+        cv::Mat level_image;
+        {
+            TraceScope scope("pyramid", "tiles");
+            cv::resize(acquire(block, level - 1), level_image, cv::Size(), 0.5, 0.5, cv::INTER_AREA);
+            scope.bytes(static_cast<int64_t>(level_image.total() * level_image.elemSize()));
+        }
+        std::lock_guard<std::mutex> lock(*cache_mutex);
+        // 延迟加载区块在生成期间已被淘汰时不缓存，保持金字塔层只随已加载的区块存在
+        if (block.loader != nullptr && block.image.empty())
+            return level_image;
+        if (block.levels.size() < static_cast<size_t>(level))
+            block.levels.resize(level);
+        if (block.levels[level - 1].empty() == false)
+            return block.levels[level - 1];
+        block.levels[level - 1] = level_image;
+        if (block.loader != nullptr)
+        {
+            cache_bytes += level_image.total() * level_image.elemSize();
+            evict();
+        }
+        return level_image;
+    }
+    // 采样游标，缓存最近访问的区块图片，只有跨越区块边界时才重新查找和获取
+    struct SampleCursor
+    {
+        cv::Point cell;
+        bool valid = false;
+        cv::Mat image;
+    };
+    // 获取第 level 层网格坐标 (x, y) 处的像素，区块空缺时为全零像素
+    // 区块图片分辨率低于该层时按最近邻取对应像素
+    const uchar *sample_pixel(SampleCursor &cursor, int x, int y, int level) const
+    {
+        static constexpr uchar zero[4] = {0, 0, 0, 0};
+        const int span = 2048 >> level;
+        cv::Point cell(floor_div(x, span), floor_div(y, span));
+        if (cursor.valid == false || cursor.cell != cell)
+        {
+            auto block = find_block_cell(cell);
+            cursor.image = block == nullptr ? cv::Mat() : acquire(*block, level);
+            cursor.cell = cell;
+            cursor.valid = true;
+        }
+        if (cursor.image.empty())
+            return zero;
+        int lx = x - cell.x * span, ly = y - cell.y * span;
+        if (cursor.image.cols != span || cursor.image.rows != span)
+        {
+            lx = lx * cursor.image.cols / span;
+            ly = ly * cursor.image.rows / span;
+        }
+        return cursor.image.ptr(ly) + static_cast<size_t>(lx) * pixel_bytes;
+    }
+    // 逐输出像素从区块采样第 begin 到 end 行，源坐标沿行线性递推
+    template <bool linear>
+    void sample_rows(cv::Mat &out, const cv::Point2d &origin, const cv::Point2d &du, const cv::Point2d &dv, int level, int begin, int end) const
+    {
+        constexpr int channels = Format::channels;
+        const int span = 2048 >> level;
+        // 第 level 层网格一个像素对应的原始像素数
+        const double unit = static_cast<double>(1 << level);
+        SampleCursor cursor;
+        for (int v = begin; v < end; v++)
+        {
+            uchar *dst = out.ptr(v);
+            cv::Point2d p = origin + dv * v;
+            for (int u = 0; u < out.cols; u++, p += du, dst += channels)
+            {
+                if constexpr (linear == false)
+                {
+                    auto src = sample_pixel(cursor, static_cast<int>(std::floor(p.x / unit)), static_cast<int>(std::floor(p.y / unit)), level);
+                    std::memcpy(dst, src, channels);
+                    continue;
+                }
+                else
+                {
+                    // 层网格中像素中心位于整数加 0.5，减去 0.5 后取相邻四个像素插值
+                    double gx = p.x / unit - 0.5, gy = p.y / unit - 0.5;
+                    int x0 = static_cast<int>(std::floor(gx)), y0 = static_cast<int>(std::floor(gy));
+                    float fx = static_cast<float>(gx - x0), fy = static_cast<float>(gy - y0);
+                    const uchar *p00 = sample_pixel(cursor, x0, y0, level);
+                    const uchar *p01, *p10, *p11;
+                    int lx = x0 - cursor.cell.x * span, ly = y0 - cursor.cell.y * span;
+                    // 四个像素都在同一张原始分辨率区块图片内时直接按偏移取，否则逐个查找所在区块
+                    if (cursor.image.cols == span && cursor.image.rows == span && lx + 1 < span && ly + 1 < span)
+                    {
+                        p01 = p00 + channels;
+                        p10 = cursor.image.ptr(ly + 1) + static_cast<size_t>(lx) * channels;
+                        p11 = p10 + channels;
+                    }
+                    else
+                    {
+                        // 各像素可能位于不同区块，先拷贝出来，避免游标切换区块后指针失效
+                        uchar pixels[3][channels];
+                        std::memcpy(pixels[0], sample_pixel(cursor, x0 + 1, y0, level), channels);
+                        std::memcpy(pixels[1], sample_pixel(cursor, x0, y0 + 1, level), channels);
+                        std::memcpy(pixels[2], sample_pixel(cursor, x0 + 1, y0 + 1, level), channels);
+                        uchar first[channels];
+                        std::memcpy(first, sample_pixel(cursor, x0, y0, level), channels);
+                        blend<channels>(dst, first, pixels[0], pixels[1], pixels[2], fx, fy);
+                        continue;
+                    }
+                    blend<channels>(dst, p00, p01, p10, p11, fx, fy);
+                }
+            }
+        }
+    }
+    template <int channels>
+    static void blend(uchar *dst, const uchar *p00, const uchar *p01, const uchar *p10, const uchar *p11, float fx, float fy)
+    {
+        for (int c = 0; c < channels; c++)
+        {
+            float top = p00[c] + (p01[c] - p00[c]) * fx;
+            float bottom = p10[c] + (p11[c] - p10[c]) * fx;
+            dst[c] = static_cast<uchar>(top + (bottom - top) * fy + 0.5f);
+        }
+    }
 
-    std::optional<std::pair<std::string, cv::Point>> parse_file_name(const std::string &name, const std::string &target_name)
+    // 记录一次查询并预测移动方向，将前方尚未加载的区块提交到预取线程
+    // 与上次查询中心相距超过一个区块视为跳转，重新估计速度
+    void observe(const cv::Rect &rect, int level) const
+    {
+        if (prefetcher.enabled == false || static_cast<size_t>(rect.area()) > prefetch_max_pixels)
+            return;
+        cv::Point2d center(rect.x + rect.width / 2.0, rect.y + rect.height / 2.0);
+        std::vector<size_t> targets;
+        {
+            std::lock_guard<std::mutex> lock(prefetcher.mutex);
+            auto &motion = prefetcher.motion();
+            auto delta = center - motion.last_center;
+            bool has_last = motion.has_last;
+            motion.has_last = true;
+            motion.last_center = center;
+            if (has_last == false || std::abs(delta.x) > 2048 || std::abs(delta.y) > 2048)
+            {
+                motion.velocity = cv::Point2d(0, 0);
+                return;
+            }
+            // 指数平均平滑速度，单位为每次查询的像素位移
+            motion.velocity = motion.velocity * 0.5 + delta * 0.5;
+            double speed = std::hypot(motion.velocity.x, motion.velocity.y);
+            if (speed < 0.5)
+                return;
+            double ahead = std::clamp(speed * prefetcher.steps, static_cast<double>(prefetcher.distance), 4096.0);
+            auto shift = motion.velocity * (ahead / speed);
+            // 当前范围沿移动方向扫过的区域，当前范围内的区块由本次查询自己加载
+            cv::Rect swept = rect | (rect + cv::Point(static_cast<int>(std::lround(shift.x)), static_cast<int>(std::lround(shift.y))));
+            cv::Point first(floor_div(swept.x, 2048), floor_div(swept.y, 2048));
+            cv::Point last(floor_div(swept.x + swept.width - 1, 2048), floor_div(swept.y + swept.height - 1, 2048));
+            std::lock_guard<std::mutex> cache_lock(*cache_mutex);
+            for (int y = first.y; y <= last.y; y++)
+                for (int x = first.x; x <= last.x; x++)
+                {
+                    if ((cv::Rect(x * 2048, y * 2048, 2048, 2048) & rect).area() > 0)
+                        continue;
+                    auto block = find_block_cell({x, y});
+                    if (block == nullptr || block->loading)
+                        continue;
+                    bool loaded = block->loader == nullptr || block->image.empty() == false;
+                    bool warm = level == 0 || (block->levels.size() >= static_cast<size_t>(level) && block->levels[level - 1].empty() == false);
+                    if (loaded && warm)
+                        continue;
+                    auto index = static_cast<size_t>(block - blocks.data());
+                    if (prefetcher.pending.insert(index).second)
+                        targets.push_back(index);
+                }
+            if (targets.empty() == false && prefetcher.worker == nullptr)
+                prefetcher.worker = std::make_unique<ThreadPool>(1);
+            for (auto index : targets)
+                prefetcher.worker->submit([this, index, level]
+                                          { prefetch(index, level); });
+        }
+    }
+    // 预取线程执行的任务，停止预取后排队中的任务直接跳过
+    void prefetch(size_t index, int level) const
+    {
+        if (prefetcher.cancelled == false)
+        {
+            TraceScope scope("prefetch", "tiles");
+            acquire(blocks[index], level);
+            BuildTrace::add(TraceCounter::tiles_prefetched);
+        }
+        std::lock_guard<std::mutex> lock(prefetcher.mutex);
+        prefetcher.pending.erase(index);
+    }
+    // 不低于目标缩放比例的最小金字塔层
+    static int pyramid_level(double scale)
+    {
+        int level = 0;
+        while (level + 1 < pyramid_levels && scale <= 1.0 / (2 << level))
+            level++;
+        return level;
+    }
+    // 淘汰最久未使用的区块直到满足内存预算，至少保留最近使用的一个区块，调用方需持有 cache_mutex
+    void evict() const
+    {
+        while (cache_bytes > cache_budget && lru.size() > 1)
+        {
+            auto &block = blocks[lru.back()];
+            cache_bytes -= block.image.total() * block.image.elemSize();
+            block.image.release();
+            // 金字塔层随区块一起淘汰
+            for (auto &level : block.levels)
+                cache_bytes -= level.total() * level.elemSize();
+            block.levels.clear();
+            lru.pop_back();
+        }
+    }
+
+    // 区块加载时的归一化：单色区块保存为 1x1 图片，边长能整除 2048 的区块保持原始分辨率，
+    // 其余区块一次缩放到 2048，使 blit 总能按整数倍只缩放查询覆盖的源区域
+    static cv::Mat compact(const cv::Mat &img)
+    {
+        if (is_uniform(img))
+            return img(cv::Rect(0, 0, 1, 1)).clone();
+        if (img.empty() == false && (2048 % img.cols != 0 || 2048 % img.rows != 0))
+        {
+            cv::Mat scaled;
+            cv::resize(img, scaled, cv::Size(2048, 2048), 0, 0, normalize_interpolation(img));
+            return scaled;
+        }
+        return img;
+    }
+    static bool is_uniform(const cv::Mat &img)
+    {
+        if (img.empty())
+            return false;
+        // 以首个像素填充一行，逐行比较，内容区块通常在第一行就会返回
+        size_t pixel = img.elemSize();
+        std::vector<uchar> row(img.cols * pixel);
+        for (int x = 0; x < img.cols; x++)
+            std::memcpy(row.data() + x * pixel, img.ptr(0), pixel);
+        for (int y = 0; y < img.rows; y++)
+            if (std::memcmp(img.ptr(y), row.data(), row.size()) != 0)
+                return false;
+        return true;
+    }
+    // 图片大小归一化时使用的插值
+    // 为了防止边缘出现淡化现象，放大时使用 INTER_NEAREST 插值
+    static int normalize_interpolation(const cv::Mat &img) { return (img.cols > 512 || img.rows > 512) ? cv::INTER_NEAREST : cv::INTER_CUBIC; }
+    // 将区块图片归一化到 2048 后 r1 范围内的部分写入 dst
+    // 区块图片经过 compact，分辨率总能整除 2048，只缩放覆盖 r1 的源区域，外扩 2 像素保证三次插值与整图缩放结果一致
+    static void blit(const cv::Mat &image, const cv::Rect &r1, cv::Mat dst)
+    {
+        if (image.cols == 2048 && image.rows == 2048)
+        {
+            image(r1).copyTo(dst);
+            return;
+        }
+        if (image.total() == 1)
+        {
+            dst.setTo(cv::mean(image));
+            return;
+        }
+        int interpolation = normalize_interpolation(image);
+        cv::Mat scaled;
+        int kx = 2048 / image.cols, ky = 2048 / image.rows;
+        cv::Rect src = cv::Rect(cv::Point(r1.x / kx - 2, r1.y / ky - 2), cv::Point((r1.br().x + kx - 1) / kx + 2, (r1.br().y + ky - 1) / ky + 2)) &
+                       cv::Rect(0, 0, image.cols, image.rows);
+        cv::resize(image(src), scaled, cv::Size(src.width * kx, src.height * ky), 0, 0, interpolation);
+        scaled(r1 - cv::Point(src.x * kx, src.y * ky)).copyTo(dst);
+    }
+
+    static std::vector<uchar> read_file(const std::filesystem::path &file)
+    {
+        std::ifstream in(file, std::ios::binary);
+        if (in.is_open() == false)
+            return {};
+        TraceScope scope("read", "tiles");
+        std::vector<uchar> bytes(std::filesystem::file_size(file));
+        in.read(reinterpret_cast<char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        scope.bytes(static_cast<int64_t>(bytes.size()));
+        BuildTrace::add(TraceCounter::bytes_read, static_cast<int64_t>(bytes.size()));
+        return bytes;
+    }
+
+    // 文件名正则由调用方构造一次，避免每个文件重复编译
+    static std::optional<std::pair<std::string, cv::Point>> parse_file_name(const std::string &name, const std::regex &reg)
     {
-        std::regex reg("UI_" + target_name + "_(-?\\d+)_(-?\\d+).png");
         std::smatch result;
         if (std::regex_match(name, result, reg) == false)
             return std::nullopt;
@@ -156,23 +996,147 @@ private:
         return std::make_pair(name, cv::Point(x, y));
     }
 
-    cv::Rect gen_bounding_rect()
+    cv::Rect gen_bounding_rect() const
     {
         return std::accumulate(blocks.begin(), blocks.end(), cv::Rect(0, 0, 16, 16), [](const cv::Rect &rect, const auto &block)
-                               { return rect | block.second.rect; });
+                               { return rect | block.rect; });
     }
 
-    std::vector<cv::Point> find_indexs(const cv::Rect &rect) { return find_indexs_abs(to_abs(rect)); }
-    std::vector<cv::Point> find_indexs_abs(const cv::Rect &rect)
+    // 区块索引对应的绝对范围，索引 (x, y) 位于第 -x - 1 行、第 -y - 1 列
+    static cv::Rect block_rect(const cv::Point &index) { return cv::Rect((-index.y - 1) * 2048, (-index.x - 1) * 2048, 2048, 2048); }
+    static cv::Point block_cell(const cv::Point &index) { return cv::Point(-index.y - 1, -index.x - 1); }
+    // 向下取整的除法，负坐标也落在正确的网格
+    static int floor_div(int a, int b) { return a >= 0 ? a / b : -((-a + b - 1) / b); }
+
+    void insert_block(Block &&block)
     {
-        if (auto r = rect & min_rect; r.area() == 0)
-            return {};
-        // 直接遍历所有区块，获取存在交集的区块的索引
-        std::vector<cv::Point> indexs;
-        std::ranges::copy_if(blocks | std::views::keys, std::back_inserter(indexs), [&](const cv::Point &index)
-                             { return (rect & blocks[index].rect).area() > 0; });
-        return indexs;
+        // 插入可能使 blocks 重新分配，先等待预取任务结束
+        prefetcher.stop();
+        // 已存在的区块保持不变
+        if (find_block(block.index) != nullptr)
+            return;
+        auto cell = block_cell(block.index);
+        if (grid_rect.contains(cell) == false)
+            grow_grid(cell);
+        min_rect |= block.rect;
+        grid[grid_offset(cell)] = static_cast<int>(blocks.size());
+        blocks.push_back(std::move(block));
+    }
+    // 扩展网格以包含新的单元，按当前尺寸的一半额外预留，使连续插入的扩展次数保持对数级
+    void grow_grid(const cv::Point &cell)
+    {
+        cv::Rect rect = grid_rect | cv::Rect(cell, cv::Size(1, 1));
+        if (grid_rect.area() > 0)
+        {
+            int pad_x = std::max(1, grid_rect.width / 2);
+            int pad_y = std::max(1, grid_rect.height / 2);
+            cv::Point tl = rect.tl(), br = rect.br();
+            if (tl.x < grid_rect.x)
+                tl.x -= pad_x;
+            if (tl.y < grid_rect.y)
+                tl.y -= pad_y;
+            if (br.x > grid_rect.br().x)
+                br.x += pad_x;
+            if (br.y > grid_rect.br().y)
+                br.y += pad_y;
+            rect = cv::Rect(tl, br);
+        }
+        grid_rect = rect;
+        grid.assign(static_cast<size_t>(grid_rect.area()), -1);
+        for (size_t i = 0; i < blocks.size(); i++)
+            grid[grid_offset(block_cell(blocks[i].index))] = static_cast<int>(i);
     }
+    size_t grid_offset(const cv::Point &cell) const
+    {
+        return static_cast<size_t>(cell.y - grid_rect.y) * grid_rect.width + (cell.x - grid_rect.x);
+    }
+    const Block *find_block(const cv::Point &index) const { return find_block_cell(block_cell(index)); }
+    const Block *find_block_cell(const cv::Point &cell) const
+    {
+        if (grid_rect.contains(cell) == false)
+            return nullptr;
+        int slot = grid[grid_offset(cell)];
+        return slot < 0 ? nullptr : &blocks[slot];
+    }
+
+private:
+    // 运动预测预取状态
+    // 移动时先停止源对象的预取线程，后台任务引用的是源对象，需在其他成员移动之前停止，因此声明为第一个数据成员
+    struct Prefetcher
+    {
+        Prefetcher() = default;
+        Prefetcher(Prefetcher &&other) noexcept
+        {
+            other.stop();
+            enabled = other.enabled.load();
+            distance = other.distance;
+            steps = other.steps;
+        }
+        Prefetcher &operator=(Prefetcher &&other) noexcept
+        {
+            stop();
+            other.stop();
+            enabled = other.enabled.load();
+            distance = other.distance;
+            steps = other.steps;
+            return *this;
+        }
+        // 等待预取线程退出并清空移动状态，不能在持有 mutex 时调用
+        void stop()
+        {
+            std::unique_ptr<ThreadPool> thread;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                thread = std::move(worker);
+            }
+            if (thread == nullptr)
+                return;
+            cancelled = true;
+            thread.reset();
+            cancelled = false;
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.clear();
+            motions.clear();
+        }
+        // 单个调用线程的移动状态
+        struct Motion
+        {
+            bool has_last = false;
+            cv::Point2d last_center;
+            cv::Point2d velocity;
+            uint64_t used = 0;
+        };
+        // 当前线程的移动状态，线程数超过 max_motions 时丢弃最久未查询的线程，需持有 mutex
+        Motion &motion()
+        {
+            auto id = std::this_thread::get_id();
+            auto it = motions.find(id);
+            if (it == motions.end())
+            {
+                if (motions.size() >= max_motions)
+                    motions.erase(std::min_element(motions.begin(), motions.end(), [](const auto &a, const auto &b)
+                                                   { return a.second.used < b.second.used; }));
+                it = motions.emplace(id, Motion()).first;
+            }
+            it->second.used = ++clock;
+            return it->second;
+        }
+        static constexpr size_t max_motions = 16;
+
+        std::atomic<bool> enabled = false;
+        int distance = 512;
+        int steps = 16;
+        std::atomic<bool> cancelled = false;
+        // 以下状态由 mutex 保护
+        std::mutex mutex;
+        std::map<std::thread::id, Motion> motions;
+        uint64_t clock = 0;
+        // 已提交但尚未完成的区块下标
+        std::set<size_t> pending;
+        // 单个后台线程，首次需要预取时创建
+        std::unique_ptr<ThreadPool> worker;
+    };
+    mutable Prefetcher prefetcher;
 
 private:
     // 原点图片在vector中的索引
@@ -182,17 +1146,47 @@ private:
     // 地图原点位置，相对于图片原点
     cv::Point map_origin;
     // 地图原点在图片左上角的绝对位置
-    cv::Point abs_origin() { return origin + map_origin; }
-    cv::Point to_abs(const cv::Point &p) { return p + abs_origin(); }
-    cv::Rect to_abs(const cv::Rect &r) { return r + abs_origin(); }
+    cv::Point abs_origin() const { return origin + map_origin; }
+    cv::Point to_abs(const cv::Point &p) const { return p + abs_origin(); }
+    cv::Rect to_abs(const cv::Rect &r) const { return r + abs_origin(); }
 
 private:
     struct Block
     {
         cv::Point index;
-        cv::Mat image;
+        // 延迟加载区块的图片属于缓存状态
+        mutable cv::Mat image;
         cv::Rect rect;
+        // 延迟加载区块的图片读取函数，为空则为常驻区块
+        std::function<cv::Mat()> loader;
+        // 已加载的延迟加载区块在 LRU 链表中的位置
+        mutable std::list<size_t>::iterator lru;
+        // 第 1 层起的金字塔图片，按需生成
+        mutable std::vector<cv::Mat> levels;
+        // 延迟加载区块正在某个线程中读取解码
+        mutable bool loading = false;
     };
-    std::map<cv::Point, Block> blocks;
-    cv::Rect min_rect;
+    std::vector<Block> blocks;
+    // 稠密网格，按行存放区块在 blocks 中的下标，-1 表示空缺
+    std::vector<int> grid;
+    // 网格覆盖的单元范围，单位为区块
+    cv::Rect grid_rect;
+    // 与 gen_bounding_rect 初值一致，插入时增量合并
+    cv::Rect min_rect = cv::Rect(0, 0, 16, 16);
+
+private:
+    // 已加载的延迟加载区块在 blocks 中的下标，最近使用的在前
+    mutable std::list<size_t> lru;
+    mutable size_t cache_bytes = 0;
+    // 保护延迟加载缓存状态与金字塔层，使用指针保持对象可移动
+    std::unique_ptr<std::mutex> cache_mutex = std::make_unique<std::mutex>();
+    // 区块加载完成时通知等待同一区块的线程
+    std::unique_ptr<std::condition_variable> cache_condition = std::make_unique<std::condition_variable>();
+    size_t cache_budget = default_cache_budget;
+    // 打包文件映射，raw 编码的区块图片引用其中的内存
+    std::shared_ptr<MappedFile> mapped;
 };
+
+using BlockMapResource = BasicBlockMapResource<PixelBGR>;
+using GrayBlockMapResource = BasicBlockMapResource<PixelGray>;
+using BGRABlockMapResource = BasicBlockMapResource<PixelBGRA>;
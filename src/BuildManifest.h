@@ -0,0 +1,278 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <charconv>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <optional>
+#include <algorithm>
+#include <filesystem>
+#include <opencv2/opencv.hpp>
+#include "ThreadPool.h"
+
+// 构建清单文件格式，文本，每行一项
+// <16 位十六进制哈希> <键>
+// 输入文件的键由调用方决定，区块为 tile:<地图名>:<x>,<y>，一张地图全部区块的组合为 tiles:<地图名>
+// 派生产物的键为 artifact:<名称>，值为生成它时全部输入哈希的组合
+
+/// @brief 构建清单，记录输入文件和派生产物的内容哈希，用于增量重建
+/// @details 输入的哈希未变化且产物文件存在时跳过该产物，只重新生成输入发生变化的部分
+///          所有接口可以被多个线程并发调用
+class BuildManifest
+{
+public:
+    /// @brief 一张地图区块的变化情况
+    struct TileChanges
+    {
+        // 新增、修改和删除的区块索引
+        std::vector<cv::Point> changed;
+        // 全部区块哈希按索引顺序的组合，作为整图产物的输入哈希
+        uint64_t hash = 0;
+        // 上次的组合哈希，changed 是相对上次的变化，只有由上次输入生成的产物才能据此增量更新
+        std::optional<uint64_t> previous_hash;
+    };
+
+public:
+    BuildManifest() = default;
+    explicit BuildManifest(const std::filesystem::path &file) { load(file); }
+    BuildManifest(const BuildManifest &) = delete;
+    BuildManifest &operator=(const BuildManifest &) = delete;
+
+public:
+    /// @brief 读取清单文件，文件不存在时清单为空
+    /// @details 之后 invalidate 会立即写回该文件
+    /// @param file 清单文件路径
+    /// @return
+    bool load(const std::filesystem::path &file)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        path = file;
+        std::ifstream in(file);
+        if (in.is_open() == false)
+            return false;
+        // 格式不正确的行忽略，对应的输入或产物视为没有记录
+        std::string line;
+        while (std::getline(in, line))
+        {
+            auto space = line.find(' ');
+            if (space == std::string::npos || space == 0 || space + 1 == line.size())
+                continue;
+            uint64_t hash = 0;
+            auto [end, error] = std::from_chars(line.data(), line.data() + space, hash, 16);
+            if (error != std::errc() || end != line.data() + space)
+                continue;
+            entries[line.substr(space + 1)] = hash;
+        }
+        return true;
+    }
+    /// @brief 写出清单文件，先写临时文件再替换，中途中断不会留下不完整的清单
+    /// @param file 清单文件路径
+    /// @return
+    bool save(const std::filesystem::path &file) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto temp = file;
+        temp += ".tmp";
+        {
+            std::ofstream out(temp, std::ios::trunc);
+            if (out.is_open() == false)
+                return false;
+            for (auto &[key, hash] : entries)
+                out << std::hex << std::setw(16) << std::setfill('0') << hash << ' ' << key << '\n';
+            if (out.good() == false)
+                return false;
+        }
+        std::error_code error;
+        std::filesystem::rename(temp, file, error);
+        return !error;
+    }
+
+    std::optional<uint64_t> get(const std::string &key) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it == entries.end())
+            return std::nullopt;
+        return it->second;
+    }
+    void set(const std::string &key, uint64_t hash)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries[key] = hash;
+    }
+    void erase(const std::string &key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.erase(key);
+    }
+
+    /// @brief 更新输入文件的哈希
+    /// @param key 输入的键
+    /// @param file 文件路径
+    /// @return 文件内容是否与上次记录不同，文件不可读时视为变化
+    bool update_input(const std::string &key, const std::filesystem::path &file)
+    {
+        auto hash = hash_file(file);
+        if (hash == std::nullopt)
+        {
+            erase(key);
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        bool changed = it == entries.end() || it->second != hash.value();
+        entries[key] = hash.value();
+        return changed;
+    }
+
+    /// @brief 并行计算一张地图全部区块文件的哈希并与清单比较
+    /// @param name 地图名，用于区分清单中不同地图的区块
+    /// @param tiles 区块文件及其索引，通常来自 BlockMapResource::scan
+    /// @param thread_count 并行计算哈希的线程数
+    /// @return TileChanges 清单中已更新为本次的区块哈希，已删除的区块从清单中移除
+    TileChanges update_tiles(const std::string &name, const std::vector<std::pair<std::filesystem::path, cv::Point>> &tiles, size_t thread_count = std::thread::hardware_concurrency())
+    {
+        std::vector<std::optional<uint64_t>> hashes(tiles.size());
+        {
+            ThreadPool pool(std::max<size_t>(thread_count, 1));
+            pool.parallel_for(tiles.size(), [&](size_t i)
+                              { hashes[i] = hash_file(tiles[i].first); });
+        }
+        // 按索引排序后组合，与目录遍历顺序无关
+        std::vector<size_t> order(tiles.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                  { auto &pa = tiles[a].second; auto &pb = tiles[b].second; return pa.y != pb.y ? pa.y < pb.y : pa.x < pb.x; });
+
+        TileChanges changes;
+        changes.hash = hash_bytes(name.data(), name.size());
+        std::string prefix = "tile:" + name + ":";
+        std::lock_guard<std::mutex> lock(mutex);
+        if (auto it = entries.find("tiles:" + name); it != entries.end())
+            changes.previous_hash = it->second;
+        std::map<std::string, uint64_t> previous;
+        for (auto it = entries.lower_bound(prefix); it != entries.end() && it->first.compare(0, prefix.size(), prefix) == 0;)
+        {
+            previous.insert(*it);
+            it = entries.erase(it);
+        }
+        for (auto i : order)
+        {
+            auto &index = tiles[i].second;
+            auto key = prefix + std::to_string(index.x) + "," + std::to_string(index.y);
+            auto it = previous.find(key);
+            // 不可读的区块不记录，下次仍视为变化
+            if (hashes[i] == std::nullopt || it == previous.end() || it->second != hashes[i].value())
+                changes.changed.push_back(index);
+            if (it != previous.end())
+                previous.erase(it);
+            if (hashes[i] == std::nullopt)
+                continue;
+            entries[key] = hashes[i].value();
+            changes.hash = combine(combine(changes.hash, static_cast<uint64_t>(static_cast<uint32_t>(index.x)) << 32 | static_cast<uint32_t>(index.y)), hashes[i].value());
+        }
+        // 剩余的是本次已不存在的区块
+        for (auto &[key, hash] : previous)
+        {
+            int x = 0, y = 0;
+            if (std::sscanf(key.c_str() + prefix.size(), "%d,%d", &x, &y) == 2)
+                changes.changed.emplace_back(x, y);
+        }
+        entries["tiles:" + name] = changes.hash;
+        return changes;
+    }
+
+    /// @brief 判断产物是否可以复用
+    /// @param artifact 产物名
+    /// @param inputs 本次全部输入哈希的组合
+    /// @param output 产物文件，为空时不检查文件
+    /// @return 上次生成时的输入哈希相同且产物文件存在
+    bool up_to_date(const std::string &artifact, uint64_t inputs, const std::filesystem::path &output = {}) const
+    {
+        auto hash = get("artifact:" + artifact);
+        return hash == inputs && (output.empty() || std::filesystem::exists(output));
+    }
+    /// @brief 记录产物已由给定输入生成，应在产物写出成功后调用
+    void record(const std::string &artifact, uint64_t inputs) { set("artifact:" + artifact, inputs); }
+    /// @brief 产物开始重建前调用，避免重建中断后残留的旧记录被误认为有效
+    /// @details 清单由文件加载时立即写回文件，进程在产物写出途中退出时，下次读取的清单中也没有该记录
+    /// @return 清单不对应文件或写回成功
+    bool invalidate(const std::string &artifact)
+    {
+        erase("artifact:" + artifact);
+        std::filesystem::path file;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            file = path;
+        }
+        return file.empty() || save(file);
+    }
+
+public:
+    /// @brief 计算内存块的 64 位哈希，用于内容变化检测，不用于安全用途
+    static uint64_t hash_bytes(const void *data, size_t size, uint64_t seed = 0x9e3779b97f4a7c15)
+    {
+        auto bytes = static_cast<const unsigned char *>(data);
+        uint64_t h = seed ^ (size * 0xff51afd7ed558ccd);
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, bytes + i, 8);
+            h = mix(h ^ word * 0x9e3779b97f4a7c15);
+        }
+        uint64_t tail = 0;
+        if (i < size)
+            std::memcpy(&tail, bytes + i, size - i);
+        return finalize(mix(h ^ tail));
+    }
+    /// @brief 分块读取文件计算哈希，不把整个文件读入内存
+    /// @return 文件不可读时为空
+    static std::optional<uint64_t> hash_file(const std::filesystem::path &file)
+    {
+        std::ifstream in(file, std::ios::binary);
+        if (in.is_open() == false)
+            return std::nullopt;
+        std::vector<char> buffer(1 << 20);
+        uint64_t h = 0;
+        while (in)
+        {
+            in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            auto count = static_cast<size_t>(in.gcount());
+            if (count == 0)
+                break;
+            h = combine(h, hash_bytes(buffer.data(), count));
+        }
+        if (in.bad())
+            return std::nullopt;
+        return h;
+    }
+    /// @brief 有序组合两个哈希
+    static uint64_t combine(uint64_t seed, uint64_t value) { return finalize(seed ^ (value + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2))); }
+
+private:
+    static uint64_t mix(uint64_t h) { return ((h << 31) | (h >> 33)) * 0xbf58476d1ce4e5b9; }
+    static uint64_t finalize(uint64_t h)
+    {
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111eb;
+        h ^= h >> 31;
+        return h;
+    }
+
+private:
+    std::map<std::string, uint64_t> entries;
+    // 加载时的清单文件路径
+    std::filesystem::path path;
+    mutable std::mutex mutex;
+};
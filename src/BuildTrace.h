@@ -0,0 +1,269 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <Psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+// 构建流程的阶段计时与计数
+// 未启用时每个计时范围只读取一次原子开关，不读取时钟也不分配内存
+// 启用后每个线程写入自己的事件缓冲区，导出时统一合并
+// 导出格式为 Chrome trace-event JSON，可以在 chrome://tracing 或 Perfetto 中打开
+
+/// @brief 构建流程的全局计数项
+enum class TraceCounter : size_t
+{
+    bytes_read,       // 读取的文件字节数
+    tiles_decoded,    // 解码的区块数
+    cache_hits,       // 延迟加载区块缓存命中次数
+    cache_misses,     // 延迟加载区块缓存未命中次数
+    items_indexed,    // 插入四叉树的物品数
+    items_found,      // 查询返回的物品数
+    tiles_prefetched, // 预取线程加载的区块数
+    count
+};
+
+/// @brief 构建流程的全局追踪记录
+class BuildTrace
+{
+public:
+    using clock = std::chrono::steady_clock;
+    /// @brief 单个计时事件，或 duration 为负的计数事件
+    struct Event
+    {
+        const char *name = nullptr;
+        const char *category = nullptr;
+        uint32_t thread = 0;
+        int64_t start = 0;    // 微秒，相对于启用时刻
+        int64_t duration = 0; // 微秒，计数事件为 -1
+        int64_t bytes = 0;
+        int64_t items = 0;
+    };
+
+public:
+    static BuildTrace &instance()
+    {
+        static BuildTrace trace;
+        return trace;
+    }
+    static bool enabled() { return instance().active.load(std::memory_order_relaxed); }
+    /// @brief 启用追踪，清空之前的事件与计数
+    static void enable()
+    {
+        auto &trace = instance();
+        trace.clear();
+        trace.epoch.store(clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+        trace.active.store(true, std::memory_order_relaxed);
+    }
+    static void disable() { instance().active.store(false, std::memory_order_relaxed); }
+
+    /// @brief 累加计数项，未启用时直接返回
+    static void add(TraceCounter counter, int64_t value = 1)
+    {
+        if (enabled() == false)
+            return;
+        instance().counters[static_cast<size_t>(counter)].fetch_add(value, std::memory_order_relaxed);
+    }
+    static int64_t get(TraceCounter counter) { return instance().counters[static_cast<size_t>(counter)].load(std::memory_order_relaxed); }
+    /// @brief 记录某一时刻的数值，在 trace 中显示为计数曲线，如缓存占用
+    /// @param name 曲线名称，需为静态字符串
+    static void sample(const char *name, int64_t value)
+    {
+        if (enabled() == false)
+            return;
+        auto &trace = instance();
+        trace.record({name, "counter", 0, trace.now(), -1, value, 0});
+    }
+    /// @brief 当前进程的常驻内存，单位字节，无法获取时为 0
+    static int64_t resident_bytes()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) == FALSE)
+            return 0;
+        return static_cast<int64_t>(counters.WorkingSetSize);
+#else
+        std::ifstream in("/proc/self/statm");
+        int64_t size = 0, resident = 0;
+        if ((in >> size >> resident).fail())
+            return 0;
+        return resident * static_cast<int64_t>(sysconf(_SC_PAGESIZE));
+#endif
+    }
+
+public:
+    /// @brief 导出 Chrome trace-event JSON
+    /// @param file 输出文件
+    /// @return
+    static bool save(const std::filesystem::path &file)
+    {
+        auto events = instance().collect();
+        std::ofstream out(file, std::ios::trunc);
+        if (out.is_open() == false)
+            return false;
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        for (size_t i = 0; i < events.size(); i++)
+        {
+            auto &e = events[i];
+            out << (i == 0 ? "" : ",\n");
+            if (e.duration < 0)
+                out << "{\"name\":\"" << e.name << "\",\"ph\":\"C\",\"pid\":1,\"tid\":0,\"ts\":" << e.start
+                    << ",\"args\":{\"value\":" << e.bytes << "}}";
+            else
+                out << "{\"name\":\"" << e.name << "\",\"cat\":\"" << e.category << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread
+                    << ",\"ts\":" << e.start << ",\"dur\":" << e.duration << ",\"args\":{\"bytes\":" << e.bytes << ",\"items\":" << e.items << "}}";
+        }
+        out << "\n]}\n";
+        return out.good();
+    }
+    /// @brief 输出各阶段的次数、总耗时、平均与最大耗时、字节数汇总表，以及全局计数项
+    static void print(std::ostream &out = std::cout)
+    {
+        struct Stage
+        {
+            size_t calls = 0;
+            int64_t total = 0;
+            int64_t max = 0;
+            int64_t bytes = 0;
+            int64_t items = 0;
+        };
+        std::map<std::string, Stage> stages;
+        for (auto &e : instance().collect())
+        {
+            if (e.duration < 0)
+                continue;
+            auto &stage = stages[std::string(e.category) + "/" + e.name];
+            stage.calls++;
+            stage.total += e.duration;
+            stage.max = std::max(stage.max, e.duration);
+            stage.bytes += e.bytes;
+            stage.items += e.items;
+        }
+        out << std::left << std::setw(28) << "stage" << std::right << std::setw(10) << "calls" << std::setw(12) << "total ms"
+            << std::setw(12) << "mean ms" << std::setw(12) << "max ms" << std::setw(12) << "MB" << std::setw(12) << "items" << std::endl;
+        for (auto &[name, stage] : stages)
+            out << std::left << std::setw(28) << name << std::right << std::setw(10) << stage.calls << std::fixed << std::setprecision(3)
+                << std::setw(12) << stage.total / 1000.0 << std::setw(12) << stage.total / 1000.0 / static_cast<double>(stage.calls)
+                << std::setw(12) << stage.max / 1000.0 << std::setw(12) << stage.bytes / (1024.0 * 1024.0) << std::setw(12) << stage.items << std::endl;
+        static const char *counter_names[] = {"bytes_read", "tiles_decoded", "cache_hits", "cache_misses", "items_indexed", "items_found", "tiles_prefetched"};
+        for (size_t i = 0; i < static_cast<size_t>(TraceCounter::count); i++)
+            out << std::left << std::setw(28) << counter_names[i] << std::right << std::setw(10) << get(static_cast<TraceCounter>(i)) << std::endl;
+        out << std::left << std::setw(28) << "resident_mb" << std::right << std::setw(10) << resident_bytes() / (1024 * 1024) << std::endl;
+    }
+
+public:
+    int64_t now() const { return std::chrono::duration_cast<std::chrono::microseconds>(clock::now().time_since_epoch() - clock::duration(epoch.load(std::memory_order_relaxed))).count(); }
+    void record(const Event &event)
+    {
+        auto &buffer = local_buffer();
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        buffer.events.push_back(event);
+        buffer.events.back().thread = buffer.thread;
+    }
+
+private:
+    // 每个线程一个缓冲区，只有导出时才会与写入线程竞争锁
+    struct Buffer
+    {
+        std::mutex mutex;
+        std::vector<Event> events;
+        uint32_t thread = 0;
+    };
+    Buffer &local_buffer()
+    {
+        thread_local std::shared_ptr<Buffer> buffer;
+        if (buffer == nullptr)
+        {
+            buffer = std::make_shared<Buffer>();
+            std::lock_guard<std::mutex> lock(mutex);
+            buffer->thread = static_cast<uint32_t>(buffers.size() + 1);
+            buffers.push_back(buffer);
+        }
+        return *buffer;
+    }
+    std::vector<Event> collect()
+    {
+        std::vector<Event> events;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &buffer : buffers)
+        {
+            std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+            events.insert(events.end(), buffer->events.begin(), buffer->events.end());
+        }
+        std::sort(events.begin(), events.end(), [](const Event &a, const Event &b)
+                  { return a.start < b.start; });
+        return events;
+    }
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &buffer : buffers)
+        {
+            std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+            buffer->events.clear();
+        }
+        for (auto &counter : counters)
+            counter.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<bool> active = false;
+    // 计时起点，enable 时可能有其他线程正在计时，以时钟计数原子存放
+    std::atomic<clock::rep> epoch = clock::now().time_since_epoch().count();
+    std::array<std::atomic<int64_t>, static_cast<size_t>(TraceCounter::count)> counters{};
+    // 线程退出后缓冲区仍由此持有，事件不会丢失
+    std::vector<std::shared_ptr<Buffer>> buffers;
+    std::mutex mutex;
+};
+
+/// @brief 计时范围，析构时记录一个事件
+/// @details 名称与分类需为静态字符串，事件只保存指针
+class TraceScope
+{
+public:
+    TraceScope(const char *name, const char *category)
+    {
+        if (BuildTrace::enabled() == false)
+            return;
+        event.name = name;
+        event.category = category;
+        event.start = BuildTrace::instance().now();
+    }
+    ~TraceScope()
+    {
+        if (event.name == nullptr)
+            return;
+        event.duration = BuildTrace::instance().now() - event.start;
+        BuildTrace::instance().record(event);
+    }
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+public:
+    /// @brief 累加本次范围处理的字节数
+    void bytes(int64_t value) { event.bytes += value; }
+    /// @brief 累加本次范围处理的项数，如区块数或物品数
+    void items(int64_t value) { event.items += value; }
+
+private:
+    BuildTrace::Event event;
+};
@@ -0,0 +1,190 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include "BlockMapResource.h"
+#include "BuildManifest.h"
+
+/// @brief 在总内存上限内并发构建多张地图
+/// @details 每张地图以延迟加载模式建立区块索引，再按条带流式导出，写出后立即释放
+///          按地图宽度预估峰值内存并向总预算申请，预算不足时等待其他地图完成
+///          提供构建清单时，区块文件内容与上次相同且输出存在的地图直接跳过
+class MapBatchBuilder
+{
+public:
+    /// @brief 单张地图的构建任务
+    struct Job
+    {
+        std::string name;
+        std::filesystem::path textures_path;
+        std::string target_name;
+        cv::Point map_origin;
+        cv::Point origin_index;
+        std::filesystem::path output;
+    };
+    /// @brief 单张地图的构建结果与耗时
+    struct Report
+    {
+        std::string name;
+        size_t tile_count = 0;
+        size_t reserved_bytes = 0;
+        double index_seconds = 0;
+        double wait_seconds = 0;
+        double export_seconds = 0;
+        bool success = false;
+        bool skipped = false;
+    };
+
+public:
+    /// @brief 构造
+    /// @param memory_budget 所有并发地图的总内存上限，单位字节
+    /// @param max_parallel 最多同时构建的地图数量
+    MapBatchBuilder(size_t memory_budget, size_t max_parallel = std::thread::hardware_concurrency())
+        : memory_budget(std::max<size_t>(memory_budget, 1)), max_parallel(std::max<size_t>(max_parallel, 1)) {}
+
+public:
+    /// @brief 扫描数据目录下的 UI_Map* 目录，为包含 Texture2D 的目录生成构建任务
+    /// @param maps_data_path 数据目录
+    /// @param output_path 输出目录，每张地图输出为 <地图名>.ppm
+    /// @return
+    static std::vector<Job> scan(const std::filesystem::path &maps_data_path, const std::filesystem::path &output_path)
+    {
+        std::vector<Job> jobs;
+        if (std::filesystem::exists(maps_data_path) == false)
+            return jobs;
+        for (auto &p : std::filesystem::directory_iterator(maps_data_path))
+        {
+            auto dir_name = p.path().filename().string();
+            if (dir_name.find("UI_Map") == std::string::npos)
+                continue;
+            auto textures_path = p.path() / "Texture2D";
+            if (std::filesystem::exists(textures_path) == false)
+                continue;
+            auto map_name = dir_name.substr(3, dir_name.size() - 3 - 1);
+            jobs.push_back({map_name, textures_path, map_name, cv::Point(0, 0), cv::Point(0, 0), output_path / (map_name + ".ppm")});
+        }
+        return jobs;
+    }
+
+    /// @brief 并发执行全部构建任务
+    /// @param jobs 构建任务
+    /// @param manifest 构建清单，为空时全部重新构建
+    /// @return 与任务一一对应的构建结果
+    std::vector<Report> run(const std::vector<Job> &jobs, BuildManifest *manifest = nullptr)
+    {
+        std::vector<Report> reports(jobs.size());
+        std::atomic<size_t> next = 0;
+        auto worker = [&]
+        {
+            for (size_t i = next++; i < jobs.size(); i = next++)
+                reports[i] = build(jobs[i], manifest);
+        };
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < std::min(max_parallel, jobs.size()); i++)
+            threads.emplace_back(worker);
+        for (auto &thread : threads)
+            thread.join();
+        return reports;
+    }
+
+    /// @brief 输出构建结果汇总表
+    /// @param reports 构建结果
+    static void print(const std::vector<Report> &reports)
+    {
+        std::cout << std::left << std::setw(24) << "map" << std::right << std::setw(8) << "tiles" << std::setw(12) << "reserve MB"
+                  << std::setw(10) << "index s" << std::setw(10) << "wait s" << std::setw(10) << "export s" << "  result" << std::endl;
+        for (auto &report : reports)
+            std::cout << std::left << std::setw(24) << report.name << std::right << std::setw(8) << report.tile_count
+                      << std::setw(12) << report.reserved_bytes / (1024 * 1024) << std::fixed << std::setprecision(3)
+                      << std::setw(10) << report.index_seconds << std::setw(10) << report.wait_seconds << std::setw(10) << report.export_seconds
+                      << "  " << (report.skipped ? "skipped" : report.success ? "ok" : "failed") << std::endl;
+    }
+
+private:
+    Report build(const Job &job, BuildManifest *manifest)
+    {
+        using clock = std::chrono::steady_clock;
+        auto seconds = [](clock::time_point a, clock::time_point b)
+        { return std::chrono::duration<double>(b - a).count(); };
+
+        TraceScope scope("build_map", "batch");
+        Report report;
+        report.name = job.name;
+        auto t0 = clock::now();
+        BuildManifest::TileChanges changes;
+        if (manifest != nullptr)
+        {
+            // 只读取区块文件计算哈希，不解码
+            auto tiles = BlockMapResource::scan(job.textures_path, job.target_name);
+            changes = manifest->update_tiles(job.name, tiles, std::max<size_t>(std::thread::hardware_concurrency() / max_parallel, 1));
+            if (manifest->up_to_date(job.name, changes.hash, job.output))
+            {
+                report.tile_count = tiles.size();
+                report.index_seconds = seconds(t0, clock::now());
+                report.success = true;
+                report.skipped = true;
+                return report;
+            }
+            manifest->invalidate(job.name);
+        }
+        // 只建立区块索引，区块在导出条带时才解码
+        BlockMapResource resource(job.textures_path, job.target_name, job.map_origin, job.origin_index, BlockMapResource::LoadMode::lazy, 0);
+        report.tile_count = resource.size();
+        auto t1 = clock::now();
+        report.index_seconds = seconds(t0, t1);
+
+        // 条带导出时同时存在：一行已解码区块（区块缓存），条带缓冲区，export_ppm 转换通道用的 RGB 条带，
+        // 以及非原生尺寸区块缩放时的临时窗口，后两者按与条带缓冲区同样大小估计
+        size_t width = static_cast<size_t>(resource.get_min_rect().width);
+        size_t row_bytes = width * 2048 * BlockMapResource::pixel_bytes;
+        size_t line_bytes = width * (BlockMapResource::pixel_bytes * 2 + 3);
+        int strip_height = 2048;
+        report.reserved_bytes = row_bytes + line_bytes * strip_height;
+        if (report.reserved_bytes > memory_budget)
+        {
+            // 地图过宽时独占全部预算，区块缓存始终保留完整一行，否则每个条带都会重新解码整行区块
+            // 只缩小条带高度；一行区块本身超过预算时条带降为 1 行，此时实际峰值会超过预算
+            auto strip_budget = memory_budget > row_bytes ? memory_budget - row_bytes : 0;
+            strip_height = static_cast<int>(std::clamp<size_t>(strip_budget / std::max<size_t>(line_bytes, 1), 1, 2048));
+            report.reserved_bytes = memory_budget;
+        }
+        reserve(report.reserved_bytes);
+        auto t2 = clock::now();
+        report.wait_seconds = seconds(t1, t2);
+
+        resource.set_cache_budget(row_bytes);
+        report.success = resource.export_ppm(job.output, strip_height);
+        auto t3 = clock::now();
+        report.export_seconds = seconds(t2, t3);
+        if (manifest != nullptr && report.success)
+            manifest->record(job.name, changes.hash);
+        // 先释放区块再归还预算
+        resource = BlockMapResource();
+        release(report.reserved_bytes);
+        return report;
+    }
+
+    void reserve(size_t bytes)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [&]
+                       { return used_bytes + bytes <= memory_budget; });
+        used_bytes += bytes;
+    }
+    void release(size_t bytes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            used_bytes -= bytes;
+        }
+        condition.notify_all();
+    }
+
+private:
+    size_t memory_budget;
+    size_t max_parallel;
+    size_t used_bytes = 0;
+    std::mutex mutex;
+    std::condition_variable condition;
+};
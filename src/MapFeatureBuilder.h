@@ -0,0 +1,278 @@
+#pragma once
+#include <fstream>
+#include <optional>
+#include "BlockMapResource.h"
+#include "BuildManifest.h"
+
+// 特征文件格式，所有字段为小端序
+// [MapFeatureHeader][MapFeaturePoint * count][描述子 count 行，每行 descriptor_cols * 元素字节数]
+// 特征点坐标为地图原点坐标系
+
+/// @brief 特征文件头
+struct MapFeatureHeader
+{
+    char magic[4] = {'B', 'M', 'R', 'F'};
+    uint32_t version = 1;
+    uint32_t count = 0;
+    uint32_t descriptor_cols = 0;
+    int32_t descriptor_type = 0;
+    uint32_t reserved = 0;
+
+    bool is_valid() const { return magic[0] == 'B' && magic[1] == 'M' && magic[2] == 'R' && magic[3] == 'F' && version == 1; }
+};
+
+/// @brief 特征文件中的单个特征点
+struct MapFeaturePoint
+{
+    float x = 0;
+    float y = 0;
+    float size = 0;
+    float angle = 0;
+    float response = 0;
+    int32_t octave = 0;
+    int32_t class_id = 0;
+};
+
+/// @brief 按区块并行提取整张地图的特征点与描述子
+/// @details 每个区块向外扩展 apron 像素后检测，只保留落在区块自身范围内的特征点
+///          地图资源可以是任意像素格式，检测只需要灰度时使用 GrayBlockMapResource 可以减少读取与合成的数据量
+///          区块范围互不重叠，重叠区域内的特征点只归属一个区块，边界附近的特征点也有完整的邻域
+class MapFeatureBuilder
+{
+public:
+    using DetectorFactory = std::function<cv::Ptr<cv::Feature2D>()>;
+    /// @brief 提取结果
+    struct Result
+    {
+        std::vector<cv::KeyPoint> keypoints;
+        cv::Mat descriptors;
+    };
+
+public:
+    /// @brief 构造
+    /// @param factory 特征检测器工厂，每个区块任务单独创建检测器
+    /// @param apron 区块向外扩展的像素数
+    /// @param settings 检测器参数的描述，计入 input_hash，修改工厂中的检测器参数时需同时修改
+    MapFeatureBuilder(DetectorFactory factory = []
+                      { return cv::SIFT::create(); },
+                      int apron = 64, std::string settings = "SIFT")
+        : factory(std::move(factory)), apron(std::max(apron, 0)), settings(std::move(settings)) {}
+
+public:
+    /// @brief 特征产物的输入哈希，用于 BuildManifest 判断特征文件能否复用
+    /// @details 组合区块内容哈希、检测器名称与描述子格式、检测器参数描述、扩展像素数和地图原点，
+    ///          任何一项变化时上次的特征都不能复用
+    /// @param map 地图资源
+    /// @param tiles 全部区块的组合哈希，通常为 BuildManifest::update_tiles 的结果
+    /// @return
+    template <typename Format>
+    uint64_t input_hash(const BasicBlockMapResource<Format> &map, uint64_t tiles) const
+    {
+        auto detector = factory();
+        auto name = detector->getDefaultName();
+        cv::Point origin = map.get_abs_origin();
+        int32_t values[5] = {detector->descriptorSize(), detector->descriptorType(), apron, origin.x, origin.y};
+        auto hash = BuildManifest::combine(tiles, BuildManifest::hash_bytes(name.data(), name.size()));
+        hash = BuildManifest::combine(hash, BuildManifest::hash_bytes(settings.data(), settings.size()));
+        return BuildManifest::combine(hash, BuildManifest::hash_bytes(values, sizeof(values)));
+    }
+
+public:
+    /// @brief 提取整张地图的特征
+    /// @param map 地图资源
+    /// @param thread_count 并行处理的区块数
+    /// @return Result 特征点为地图原点坐标系
+    template <typename Format>
+    Result build(const BasicBlockMapResource<Format> &map, size_t thread_count = std::thread::hardware_concurrency()) const
+    {
+        auto rects = map.get_block_rects();
+        std::vector<Result> tiles(rects.size());
+        ThreadPool pool(std::max<size_t>(thread_count, 1));
+        pool.parallel_for(rects.size(), [&](size_t i)
+                          { tiles[i] = build_tile(map, rects[i]); });
+        return merge(tiles);
+    }
+
+    /// @brief 增量提取整张地图的特征
+    /// @details 区块的特征只取决于区块自身及扩展区域内的像素，扩展范围不与任何变化区块相交的区块直接复用上次结果
+    ///          已删除区块的特征点不再属于任何区块，自然被丢弃
+    /// @param map 地图资源
+    /// @param previous 上次的提取结果，需与本次使用相同的检测器、扩展像素数和地图原点，即 input_hash 中除区块外的部分相同
+    /// @param changed 新增、修改和删除的区块索引
+    /// @param thread_count 并行处理的区块数
+    /// @return Result 特征点为地图原点坐标系
+    template <typename Format>
+    Result build(const BasicBlockMapResource<Format> &map, const Result &previous, const std::vector<cv::Point> &changed, size_t thread_count = std::thread::hardware_concurrency()) const
+    {
+        std::vector<cv::Rect> dirty;
+        dirty.reserve(changed.size());
+        for (auto &index : changed)
+            dirty.push_back(BasicBlockMapResource<Format>::get_block_rect(index));
+
+        auto rects = map.get_block_rects();
+        std::vector<Result> tiles(rects.size());
+        std::vector<size_t> rebuild;
+        // 可复用区块的左上角绝对坐标
+        std::map<cv::Point, size_t> reuse;
+        cv::Point abs_origin = map.get_abs_origin();
+        for (size_t i = 0; i < rects.size(); i++)
+        {
+            cv::Rect rect(rects[i].x - apron, rects[i].y - apron, rects[i].width + apron * 2, rects[i].height + apron * 2);
+            bool is_dirty = std::any_of(dirty.begin(), dirty.end(), [&](const cv::Rect &r)
+                                        { return (r & rect).area() > 0; });
+            if (is_dirty)
+                rebuild.push_back(i);
+            else
+                reuse[rects[i].tl()] = i;
+        }
+        // 按所在区块分拣上次的特征点，地图原点需与上次相同
+        std::vector<std::vector<int>> rows(rects.size());
+        for (int k = 0; k < static_cast<int>(previous.keypoints.size()); k++)
+        {
+            auto &pt = previous.keypoints[k].pt;
+            cv::Point tl(floor_tile(abs_origin.x + static_cast<int>(std::floor(pt.x))), floor_tile(abs_origin.y + static_cast<int>(std::floor(pt.y))));
+            auto it = reuse.find(tl);
+            if (it != reuse.end())
+                rows[it->second].push_back(k);
+        }
+        for (auto &[tl, i] : reuse)
+        {
+            auto &tile = tiles[i];
+            for (auto k : rows[i])
+                tile.keypoints.push_back(previous.keypoints[k]);
+            if (rows[i].empty() == false)
+            {
+                tile.descriptors.create(static_cast<int>(rows[i].size()), previous.descriptors.cols, previous.descriptors.type());
+                for (size_t r = 0; r < rows[i].size(); r++)
+                    previous.descriptors.row(rows[i][r]).copyTo(tile.descriptors.row(static_cast<int>(r)));
+            }
+        }
+        ThreadPool pool(std::max<size_t>(thread_count, 1));
+        pool.parallel_for(rebuild.size(), [&](size_t i)
+                          { tiles[rebuild[i]] = build_tile(map, rects[rebuild[i]]); });
+        return merge(tiles);
+    }
+
+    /// @brief 保存特征文件
+    /// @param file 文件路径
+    /// @param result 提取结果
+    /// @return
+    static bool save(const std::filesystem::path &file, const Result &result)
+    {
+        std::ofstream out(file, std::ios::binary | std::ios::trunc);
+        if (out.is_open() == false)
+            return false;
+        MapFeatureHeader header;
+        header.count = static_cast<uint32_t>(result.keypoints.size());
+        header.descriptor_cols = static_cast<uint32_t>(result.descriptors.cols);
+        header.descriptor_type = result.descriptors.type();
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        std::vector<MapFeaturePoint> points(result.keypoints.size());
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            auto &kp = result.keypoints[i];
+            points[i] = {kp.pt.x, kp.pt.y, kp.size, kp.angle, kp.response, kp.octave, kp.class_id};
+        }
+        out.write(reinterpret_cast<const char *>(points.data()), static_cast<std::streamsize>(points.size() * sizeof(MapFeaturePoint)));
+        for (int row = 0; row < result.descriptors.rows; row++)
+            out.write(reinterpret_cast<const char *>(result.descriptors.ptr(row)), static_cast<std::streamsize>(result.descriptors.cols * result.descriptors.elemSize()));
+        return out.good();
+    }
+
+    /// @brief 读取特征文件
+    /// @param file 文件路径
+    /// @return Result 文件不存在、格式不匹配或大小与文件头不一致时为空
+    static std::optional<Result> load(const std::filesystem::path &file)
+    {
+        std::error_code error;
+        auto file_size = std::filesystem::file_size(file, error);
+        std::ifstream in(file, std::ios::binary);
+        MapFeatureHeader header;
+        if (error || in.read(reinterpret_cast<char *>(&header), sizeof(header)).good() == false || header.is_valid() == false)
+            return std::nullopt;
+        // 先按文件头核对文件大小，截断或损坏的文件头不会导致按错误的数量分配
+        if (header.count > 0 && (header.descriptor_cols == 0 || CV_MAT_CN(header.descriptor_type) != 1))
+            return std::nullopt;
+        auto element_size = static_cast<uint64_t>(CV_ELEM_SIZE1(header.descriptor_type));
+        if (file_size != sizeof(header) + static_cast<uint64_t>(header.count) * (sizeof(MapFeaturePoint) + header.descriptor_cols * element_size))
+            return std::nullopt;
+        Result result;
+        std::vector<MapFeaturePoint> points(header.count);
+        in.read(reinterpret_cast<char *>(points.data()), static_cast<std::streamsize>(points.size() * sizeof(MapFeaturePoint)));
+        cv::Mat descriptors(static_cast<int>(header.count), static_cast<int>(header.descriptor_cols), header.descriptor_type);
+        for (int row = 0; row < descriptors.rows; row++)
+            in.read(reinterpret_cast<char *>(descriptors.ptr(row)), static_cast<std::streamsize>(descriptors.cols * descriptors.elemSize()));
+        if (in.good() == false)
+            return std::nullopt;
+        result.keypoints.reserve(points.size());
+        for (auto &p : points)
+            result.keypoints.emplace_back(cv::Point2f(p.x, p.y), p.size, p.angle, p.response, p.octave, p.class_id);
+        result.descriptors = descriptors;
+        return result;
+    }
+
+private:
+    // 按区块顺序拼接结果，输出与并行调度顺序无关
+    static Result merge(const std::vector<Result> &tiles)
+    {
+        Result result;
+        size_t count = 0;
+        for (auto &tile : tiles)
+            count += tile.keypoints.size();
+        result.keypoints.reserve(count);
+        std::vector<cv::Mat> descriptors;
+        for (auto &tile : tiles)
+        {
+            if (tile.keypoints.empty())
+                continue;
+            result.keypoints.insert(result.keypoints.end(), tile.keypoints.begin(), tile.keypoints.end());
+            descriptors.push_back(tile.descriptors);
+        }
+        if (descriptors.empty() == false)
+            cv::vconcat(descriptors, result.descriptors);
+        return result;
+    }
+    // 绝对坐标所在区块的左上角
+    static int floor_tile(int v) { return (v >= 0 ? v / 2048 : -((-v + 2047) / 2048)) * 2048; }
+
+    template <typename Format>
+    Result build_tile(const BasicBlockMapResource<Format> &map, const cv::Rect &tile) const
+    {
+        TraceScope scope("detect", "features");
+        Result result;
+        cv::Rect rect(tile.x - apron, tile.y - apron, tile.width + apron * 2, tile.height + apron * 2);
+        cv::Mat image = map.view_abs(rect);
+        auto detector = factory();
+        std::vector<cv::KeyPoint> detected;
+        cv::Mat descriptors;
+        // 检测与描述共用一次尺度空间构建，之后按行筛选
+        detector->detectAndCompute(image, cv::noArray(), detected, descriptors);
+        // 只保留落在区块自身范围内的特征点，扩展区域内的由相邻区块负责
+        cv::Rect2f core(static_cast<float>(apron), static_cast<float>(apron), static_cast<float>(tile.width), static_cast<float>(tile.height));
+        std::vector<cv::KeyPoint> keypoints;
+        std::vector<int> rows;
+        for (int k = 0; k < static_cast<int>(detected.size()); k++)
+            if (core.contains(detected[k].pt))
+            {
+                keypoints.push_back(detected[k]);
+                rows.push_back(k);
+            }
+        if (keypoints.empty())
+            return result;
+        result.descriptors.create(static_cast<int>(rows.size()), descriptors.cols, descriptors.type());
+        for (size_t r = 0; r < rows.size(); r++)
+            descriptors.row(rows[r]).copyTo(result.descriptors.row(static_cast<int>(r)));
+        // 转换到地图原点坐标系
+        cv::Point2f offset(cv::Point(rect.tl() - map.get_abs_origin()));
+        for (auto &kp : keypoints)
+            kp.pt += offset;
+        result.keypoints = std::move(keypoints);
+        scope.items(static_cast<int64_t>(result.keypoints.size()));
+        return result;
+    }
+
+private:
+    DetectorFactory factory;
+    int apron;
+    std::string settings;
+};
@@ -1,13 +1,26 @@
 #pragma once
 #include <map>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <list>
 #include <regex>
 #include <future>
 #include <ranges>
+#include <span>
 #include <memory>
+#include <mutex>
 #include <vector>
 #include <numeric>
+#include <algorithm>
+#include <iostream>
+#include <functional>
 #include <filesystem>
 #include <opencv2/opencv.hpp>
+#include "BuildTrace.h"
+#include "ThreadPool.h"
+#include "PackedTileFile.h"
 
 /// @brief 用来存储物品项的详细信息接口
 class ItemInface
@@ -31,6 +44,16 @@ public:
     /// @param rect 范围
     /// @return std::vector<std::shared_ptr<ItemInface>> 物品项集合
     virtual std::vector<std::shared_ptr<ItemInface>> find(const cv::Rect2d &rect) = 0;
+    /// @brief 查找距离位置最近的若干物品项
+    /// @param pos 位置
+    /// @param k 数量
+    /// @return std::vector<std::shared_ptr<ItemInface>> 物品项集合，按距离从近到远排列
+    virtual std::vector<std::shared_ptr<ItemInface>> nearest(const cv::Point2d &pos, size_t k) = 0;
+    /// @brief 查找与位置距离不超过半径的物品项
+    /// @param pos 位置
+    /// @param radius 半径
+    /// @return std::vector<std::shared_ptr<ItemInface>> 物品项集合，按距离从近到远排列
+    virtual std::vector<std::shared_ptr<ItemInface>> within(const cv::Point2d &pos, double radius) = 0;
 
 public:
     /// @brief 判断物品项集合是否为空
@@ -54,289 +77,1424 @@ public:
     cv::Mat image;
     std::string description;
 };
+// 四叉树文件格式，所有字段为小端序，各段按 8 字节对齐
+// [ItemTreeHeader][节点 * node_count][x * slot_count][y * slot_count][编号 * slot_count][位置 * payload_count]
+// 节点之间以下标引用，文件与加载地址无关，映射后可以直接查询
+
+/// @brief 四叉树文件头
+struct ItemTreeHeader
+{
+    char magic[4] = {'I', 'S', 'T', 'F'};
+    uint32_t version = 2;
+    uint32_t node_bytes = 0; // 节点结构大小，布局不一致的文件不加载
+    uint32_t node_count = 0;
+    uint32_t slot_count = 0;
+    uint32_t payload_count = 0;
+    uint64_t node_offset = 0;
+    uint64_t xs_offset = 0;
+    uint64_t ys_offset = 0;
+    uint64_t ids_offset = 0;
+    uint64_t position_offset = 0; // 按编号存放的物品位置，已删除的编号为 NaN
+
+    bool is_valid() const { return magic[0] == 'I' && magic[1] == 'S' && magic[2] == 'T' && magic[3] == 'F' && version == 2; }
+};
+
+/// @brief 连续数组，持有自己的存储，或者作为外部只读内存的视图
+/// @details 视图状态下只能读取，修改大小前会先复制为自有存储；按下标写入前需调用 detach
+template <typename T>
+class FlatArray
+{
+public:
+    FlatArray() = default;
+    FlatArray(const FlatArray &other) { *this = other; }
+    FlatArray(FlatArray &&other) noexcept { *this = std::move(other); }
+    FlatArray &operator=(const FlatArray &other)
+    {
+        if (this == &other)
+            return *this;
+        owned = other.owned;
+        borrowed = other.borrowed;
+        items = borrowed ? other.items : owned.data();
+        length = other.length;
+        return *this;
+    }
+    FlatArray &operator=(FlatArray &&other) noexcept
+    {
+        owned = std::move(other.owned);
+        borrowed = other.borrowed;
+        items = borrowed ? other.items : owned.data();
+        length = other.length;
+        other.owned.clear();
+        other.borrowed = false;
+        other.sync();
+        return *this;
+    }
+
+public:
+    T &operator[](size_t i) { return items[i]; }
+    const T &operator[](size_t i) const { return items[i]; }
+    T *data() { return items; }
+    const T *data() const { return items; }
+    T *begin() { return items; }
+    T *end() { return items + length; }
+    const T *begin() const { return items; }
+    const T *end() const { return items + length; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+
+public:
+    void resize(size_t count)
+    {
+        detach();
+        owned.resize(count);
+        sync();
+    }
+    void reserve(size_t count)
+    {
+        detach();
+        owned.reserve(count);
+        sync();
+    }
+    void assign(size_t count, const T &value)
+    {
+        borrowed = false;
+        owned.assign(count, value);
+        sync();
+    }
+    void assign(std::vector<T> &&values)
+    {
+        borrowed = false;
+        owned = std::move(values);
+        sync();
+    }
+    template <typename It>
+    void append(It first, It last)
+    {
+        detach();
+        owned.insert(owned.end(), first, last);
+        sync();
+    }
+    /// @brief 作为外部只读内存的视图，内存需在视图使用期间保持有效
+    void borrow(const T *data, size_t count)
+    {
+        owned = std::vector<T>();
+        items = const_cast<T *>(data);
+        length = count;
+        borrowed = true;
+    }
+    /// @brief 视图复制为自有存储
+    void detach()
+    {
+        if (borrowed == false)
+            return;
+        owned.assign(items, items + length);
+        borrowed = false;
+        sync();
+    }
+
+private:
+    void sync()
+    {
+        items = owned.data();
+        length = owned.size();
+    }
+
+private:
+    std::vector<T> owned;
+    T *items = nullptr;
+    size_t length = 0;
+    bool borrowed = false;
+};
+
 /// @brief 用来存储物品项集合的四叉树实现类
+/// @details 布局：节点连续存放在数组中，以下标互相引用，四个子节点连续存放；叶子的物品坐标按 x、y 分别存放在
+///          连续的槽位中，物品本身按编号引用。每个节点保存子树的物品数、坐标和与包围盒
+///          查询：只遍历节点与坐标数组，不访问物品对象；完全落在范围内的子树整体输出，最近邻按节点距离由近到远剪枝，
+///          批量查询分组并行，聚类直接使用节点统计量
+///          修改：构造时按 Morton 键排序后并行建立整棵树；插入、删除与移动逐个进行，根节点范围不足时加倍扩大，
+///          物品过少的子树合并回叶子，废弃的节点块与槽位复用或累积过多时整理。修改会使之前取得的节点指针失效
+///          持久化：整棵树保存为二进制文件，打开时直接映射文件中的数组，修改前才复制为自有存储
 class ItemSetTree : public ItemSetInface
 {
+public:
+    // 叶子节点物品数量超过该值时分裂
+    static constexpr uint32_t node_item_max = 32;
+    // 最大深度，相同位置的大量物品无法再分开，达到该深度的叶子不再分裂
+    static constexpr int max_depth = 24;
+    // 表示没有子节点
+    static constexpr uint32_t no_child = 0;
+    // 表示没有找到槽位
+    static constexpr uint32_t no_slot = UINT32_MAX;
+    // 表示没有对应的物品编号
+    static constexpr uint32_t no_id = UINT32_MAX;
+    // 批量建立时物品数不超过该值的子树作为一个并行任务
+    static constexpr uint32_t parallel_grain = 4096;
+    // 批量查询时每个并行任务处理的范围数量
+    static constexpr size_t batch_grain = 64;
+    // 删除后子树物品数不超过该值时合并为一个叶子，低于分裂阈值以免反复分裂合并
+    static constexpr uint32_t node_item_merge = node_item_max / 2;
+    // 废弃槽位超过该值且超过物品数时整理坐标数组
+    static constexpr size_t garbage_min = 4096;
+
+    /// @brief 四叉树节点
+    struct Node
+    {
+        cv::Rect2d rect;
+        // 第一个子节点的下标，四个子节点依次为左上、右上、左下、右下，no_child 表示叶子节点
+        uint32_t child = no_child;
+        // 叶子节点的物品在坐标数组中的起始槽位、已用数量与容量
+        uint32_t begin = 0;
+        uint32_t count = 0;
+        uint32_t capacity = 0;
+        // 包括递归子节点的物品数量
+        uint32_t size = 0;
+        // 包括递归子节点的物品坐标和，以及物品位置的包围盒，没有物品时 lower 大于 upper
+        cv::Point2d sum = {0, 0};
+        cv::Point2d lower = {INFINITY, INFINITY};
+        cv::Point2d upper = {-INFINITY, -INFINITY};
+
+        bool is_leaf() const { return child == no_child; }
+        cv::Point2d center() const { return rect.tl() + cv::Point2d(rect.width / 2.0, rect.height / 2.0); }
+        /// @brief 子树物品位置的平均值
+        cv::Point2d centroid() const { return size == 0 ? center() : sum / static_cast<double>(size); }
+        /// @brief 子树物品位置的包围盒
+        cv::Rect2d bounds() const { return size == 0 ? cv::Rect2d() : cv::Rect2d(lower, upper); }
+        // 累加一个物品位置
+        void add(const cv::Point2d &pos)
+        {
+            sum += pos;
+            lower = {std::min(lower.x, pos.x), std::min(lower.y, pos.y)};
+            upper = {std::max(upper.x, pos.x), std::max(upper.y, pos.y)};
+        }
+    };
+
+    /// @brief 聚类查询结果，一个单元内的物品或单个物品
+    struct Cluster
+    {
+        cv::Point2d center; // 物品位置的平均值
+        cv::Rect2d bounds;  // 物品位置的包围盒
+        uint32_t count = 0;
+        uint32_t id = no_id; // 只有一个物品时为其编号
+    };
+
+    /// @brief 批量查询结果，第 i 个范围的物品编号为 ids[offsets[i], offsets[i + 1])
+    struct BatchResult
+    {
+        std::vector<size_t> offsets;
+        std::vector<uint32_t> ids;
+
+        /// @brief 范围数量
+        size_t size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+        /// @brief 第 i 个范围内的物品编号
+        std::span<const uint32_t> operator[](size_t i) const { return {ids.data() + offsets[i], offsets[i + 1] - offsets[i]}; }
+    };
+
 public:
     ItemSetTree() = default;
     ~ItemSetTree() = default;
-    ItemSetTree(const cv::Rect2d &rect, const std::vector<std::shared_ptr<ItemInface>> &items)
+    ItemSetTree(const cv::Rect2d &rect, const std::vector<std::shared_ptr<ItemInface>> &items, size_t thread_count = std::thread::hardware_concurrency())
     {
-        root = std::make_shared<Node>();
-        root->rect = rect;
-        root->center = rect.tl() + cv::Point2d(rect.width / 2.0, rect.height / 2.0);
-        for (auto &item : items)
-            root->insert(item);
+        build(rect, items, thread_count);
     }
 
 public:
-    class Node : public std::enable_shared_from_this<Node>
+    /// @brief 批量建立整棵树，替换已有内容
+    /// @details 按逐层象限序号组成的 Morton 键排序后，每个节点的物品都是连续的一段，
+    ///          由键的对应位直接划分四个子节点，叶子直接使用排序后的槽位，不逐个插入也不搬移物品
+    ///          结果与逐个插入得到的节点划分一致
+    /// @param rect 初始根节点范围，范围外的物品项会像 insert 一样加倍扩展根节点；
+    ///             空物品项、位置无效的物品项以及 rect 为空时范围外的物品项不会被插入，其编号留给之后插入的物品复用
+    /// @param items 物品项，物品编号为其下标
+    /// @param thread_count 计算键与建立子树同时使用的最多线程数，包括调用线程；另外不超过物品数 / parallel_grain
+    void build(const cv::Rect2d &rect, const std::vector<std::shared_ptr<ItemInface>> &items, size_t thread_count = std::thread::hardware_concurrency())
+    {
+        TraceScope scope("build", "items");
+        scope.items(static_cast<int64_t>(items.size()));
+        BuildTrace::add(TraceCounter::items_indexed, static_cast<int64_t>(items.size()));
+        mapping.reset();
+        saved.reset();
+        mapped_positions = nullptr;
+        free_blocks.clear();
+        free_ids.clear();
+        garbage_slots = 0;
+        payloads.assign(items.begin(), items.end());
+        // 根节点范围按 grow 的方式加倍直到包含所有物品项，无法包含的物品项不插入，其编号留给之后插入的物品复用
+        auto root = rect;
+        std::vector<uint32_t> valid;
+        valid.reserve(payloads.size());
+        for (uint32_t id = 0; id < payloads.size(); id++)
+        {
+            if (payloads[id] != nullptr && cover(root, payloads[id]->pos))
+                valid.push_back(id);
+            else
+            {
+                payloads[id] = nullptr;
+                free_ids.push_back(id);
+            }
+        }
+        auto count = static_cast<uint32_t>(valid.size());
+        thread_count = std::max<size_t>(std::min<size_t>(thread_count, count / parallel_grain), 1);
+
+        // 计算键并排序
+        std::vector<std::pair<uint64_t, uint32_t>> keys(count);
+        auto compute = [&](size_t i)
+        { keys[i] = {morton_key(root, payloads[valid[i]]->pos), valid[i]}; };
+        if (thread_count > 1)
+            shared_pool().parallel_for(count, compute, thread_count);
+        else
+            for (size_t i = 0; i < count; i++)
+                compute(i);
+        std::sort(keys.begin(), keys.end());
+        xs.assign(count, 0);
+        ys.assign(count, 0);
+        ids.assign(count, 0);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            ids[i] = keys[i].second;
+            xs[i] = payloads[ids[i]]->pos.x;
+            ys[i] = payloads[ids[i]]->pos.y;
+        }
+
+        // 上层节点顺序建立，物品数不超过 parallel_grain 的子树留给并行任务
+        std::vector<Subtree> tasks;
+        std::vector<Node> built(1, {root});
+        build_range(built, keys, 0, 0, count, 0, thread_count > 1 ? &tasks : nullptr);
+        std::vector<std::vector<Node>> locals(tasks.size());
+        shared_pool().parallel_for(tasks.size(), [&](size_t i)
+                                  {
+                                      auto &task = tasks[i];
+                                      locals[i].push_back(built[task.index]);
+                                      build_range(locals[i], keys, 0, task.begin, task.end, task.depth, nullptr); },
+                                  thread_count);
+        // 拼接各子树，子树内的下标整体偏移
+        for (size_t i = 0; i < tasks.size(); i++)
+        {
+            auto offset = static_cast<uint32_t>(built.size()) - 1;
+            auto &local = locals[i];
+            for (auto &node : local)
+                if (node.is_leaf() == false)
+                    node.child += offset;
+            built[tasks[i].index] = local[0];
+            built.insert(built.end(), local.begin() + 1, local.end());
+        }
+        nodes.assign(std::move(built));
+        // 子节点总在父节点之后，逆序即可自下而上计算统计量
+        for (auto index = static_cast<uint32_t>(nodes.size()); index-- > 0;)
+            update_node(index);
+    }
+    /// @brief 保存为二进制文件，节点按遍历顺序重新编号，槽位紧凑存放，不包含废弃的节点与槽位
+    /// @details 物品项只保存位置，加载时按编号对应物品项
+    /// @param file 输出文件
+    /// @return
+    bool save(const std::filesystem::path &file) const
     {
-    public:
-        enum class SplitType
+        static_assert(std::is_trivially_copyable_v<Node>, "Node is written to the file as raw bytes");
+        TraceScope scope("save", "items");
+        std::vector<Node> packed_nodes;
+        std::vector<double> packed_xs, packed_ys;
+        std::vector<uint32_t> packed_ids;
+        pack(packed_nodes, packed_xs, packed_ys, packed_ids);
+        auto &all = all_payloads();
+        std::vector<cv::Point2d> positions(all.size(), cv::Point2d(NAN, NAN));
+        for (size_t id = 0; id < all.size(); id++)
+            if (all[id] != nullptr && (mapped_positions == nullptr || is_valid(mapped_positions[id])))
+                positions[id] = all[id]->pos;
+
+        ItemTreeHeader header;
+        header.node_bytes = sizeof(Node);
+        header.node_count = static_cast<uint32_t>(packed_nodes.size());
+        header.slot_count = static_cast<uint32_t>(packed_xs.size());
+        header.payload_count = static_cast<uint32_t>(positions.size());
+        uint64_t offset = sizeof(ItemTreeHeader);
+        auto place = [&](uint64_t bytes)
         {
-            top_left,
-            top_right,
-            bottom_left,
-            bottom_right
+            offset = (offset + 7) / 8 * 8;
+            auto at = offset;
+            offset += bytes;
+            return at;
         };
+        header.node_offset = place(packed_nodes.size() * sizeof(Node));
+        header.xs_offset = place(packed_xs.size() * sizeof(double));
+        header.ys_offset = place(packed_ys.size() * sizeof(double));
+        header.ids_offset = place(packed_ids.size() * sizeof(uint32_t));
+        header.position_offset = place(positions.size() * sizeof(cv::Point2d));
+
+        std::ofstream out(file, std::ios::binary | std::ios::trunc);
+        if (out.is_open() == false)
+            return false;
+        auto write = [&](uint64_t at, const void *data, uint64_t bytes)
+        {
+            static const char zeros[8] = {};
+            out.write(zeros, static_cast<std::streamsize>(at - static_cast<uint64_t>(out.tellp())));
+            out.write(static_cast<const char *>(data), static_cast<std::streamsize>(bytes));
+        };
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        write(header.node_offset, packed_nodes.data(), packed_nodes.size() * sizeof(Node));
+        write(header.xs_offset, packed_xs.data(), packed_xs.size() * sizeof(double));
+        write(header.ys_offset, packed_ys.data(), packed_ys.size() * sizeof(double));
+        write(header.ids_offset, packed_ids.data(), packed_ids.size() * sizeof(uint32_t));
+        write(header.position_offset, positions.data(), positions.size() * sizeof(cv::Point2d));
+        scope.bytes(static_cast<int64_t>(offset));
+        scope.items(static_cast<int64_t>(size()));
+        return out.good();
+    }
+    /// @brief 映射 save 保存的文件，节点与坐标数组直接引用映射内存，不重新建立
+    /// @details 打开时只检查各段范围与节点结构，耗时与节点数成正比，不遍历物品
+    ///          槽位中的物品编号在取物品项时检查，超出范围的编号没有对应的物品项，不会越界访问
+    ///          已删除编号的收集推迟到第一次修改，之后的插入、删除等修改会先将数组复制为自有存储
+    /// @param file 文件
+    /// @param items 按编号对应的物品项，需与保存时的编号一致且数量相同；
+    ///              为空时物品项是只有位置的 ItemInface，在第一次需要物品项时按文件中的位置一次创建，不保留派生类的其他信息
+    /// @return 损坏的文件返回 false 且不修改当前内容
+    bool open(const std::filesystem::path &file, const std::vector<std::shared_ptr<ItemInface>> &items = {})
+    {
+        TraceScope scope("open", "items");
+        auto mapped = std::make_shared<MappedFile>(file);
+        ItemTreeHeader header;
+        if (mapped->data() == nullptr || mapped->size() < sizeof(header))
+            return false;
+        std::memcpy(&header, mapped->data(), sizeof(header));
+        if (header.is_valid() == false || header.node_bytes != sizeof(Node))
+            return false;
+        auto in_file = [&](uint64_t offset, uint64_t count, uint64_t bytes)
+        { return offset % 8 == 0 && offset <= mapped->size() && count <= (mapped->size() - offset) / bytes; };
+        if (in_file(header.node_offset, header.node_count, sizeof(Node)) == false ||
+            in_file(header.xs_offset, header.slot_count, sizeof(double)) == false ||
+            in_file(header.ys_offset, header.slot_count, sizeof(double)) == false ||
+            in_file(header.ids_offset, header.slot_count, sizeof(uint32_t)) == false ||
+            in_file(header.position_offset, header.payload_count, sizeof(cv::Point2d)) == false)
+            return false;
+        if (items.empty() == false && items.size() != header.payload_count)
+            return false;
+        auto node_data = reinterpret_cast<const Node *>(mapped->data() + header.node_offset);
+        // 子节点总在父节点之后，遍历不会成环
+        for (uint32_t i = 0; i < header.node_count; i++)
+        {
+            auto &node = node_data[i];
+            if (node.is_leaf() ? uint64_t(node.begin) + node.count > header.slot_count : node.child <= i || uint64_t(node.child) + 4 > header.node_count)
+                return false;
+        }
+        auto position_data = reinterpret_cast<const cv::Point2d *>(mapped->data() + header.position_offset);
+        nodes.borrow(node_data, header.node_count);
+        xs.borrow(reinterpret_cast<const double *>(mapped->data() + header.xs_offset), header.slot_count);
+        ys.borrow(reinterpret_cast<const double *>(mapped->data() + header.ys_offset), header.slot_count);
+        ids.borrow(reinterpret_cast<const uint32_t *>(mapped->data() + header.ids_offset), header.slot_count);
+        payloads.assign(items.begin(), items.end());
+        saved.reset();
+        if (items.empty())
+            saved = std::make_shared<SavedPayloads>(mapped, position_data, header.payload_count);
+        mapped_positions = position_data;
+        free_ids.clear();
+        free_blocks.clear();
+        garbage_slots = 0;
+        mapping = mapped;
+        scope.bytes(static_cast<int64_t>(mapped->size()));
+        scope.items(static_cast<int64_t>(size()));
+        BuildTrace::add(TraceCounter::bytes_read, static_cast<int64_t>(mapped->size()));
+        return true;
+    }
 
-    public:
-        Node() = default;
-        Node(const std::vector<std::shared_ptr<ItemInface>> items)
+public:
+    /// @brief 插入物品项，位置不在根节点范围内时先扩大根节点
+    /// @details 删除留下的编号会被复用
+    /// @param item 物品项
+    /// @return 是否插入，空物品项、位置无效或树未建立时为 false
+    bool insert(const std::shared_ptr<ItemInface> &item)
+    {
+        if (item == nullptr || nodes.empty() || is_valid(item->pos) == false)
+            return false;
+        detach();
+        if (grow(item->pos) == false)
+            return false;
+        uint32_t id;
+        if (free_ids.empty())
         {
-            for (auto &item : items)
-                insert(item);
+            id = static_cast<uint32_t>(payloads.size());
+            payloads.push_back(item);
         }
-        Node(std::shared_ptr<Node> parent, SplitType split_type) : parent(parent)
+        else
         {
-            // set rect and center
-            auto split_size = cv::Size2d(parent->rect.width / 2.0, parent->rect.height / 2.0);
-            auto split_center = cv::Point2d(parent->rect.width / 4.0, parent->rect.height / 4.0);
-            switch (split_type)
-            {
-            case SplitType::top_left:
-                rect = cv::Rect2d(parent->rect.tl(), split_size);
-                center = rect.tl() + split_center;
-                break;
-            case SplitType::top_right:
-                rect = cv::Rect2d(parent->rect.tl() + cv::Point2d(parent->rect.width / 2, 0), split_size);
-                center = rect.tl() + split_center;
-                break;
-            case SplitType::bottom_left:
-                rect = cv::Rect2d(parent->rect.tl() + cv::Point2d(0, parent->rect.height / 2), split_size);
-                center = rect.tl() + split_center;
-                break;
-            case SplitType::bottom_right:
-                rect = cv::Rect2d(parent->rect.tl() + cv::Point2d(parent->rect.width / 2, parent->rect.height / 2), split_size);
-                center = rect.tl() + split_center;
-                break;
-            default:
-                throw std::runtime_error("Node unknown split type");
-            }
-            // split items to childs
-            auto copy_items = parent->items;
-            for (auto &item : copy_items)
+            id = free_ids.back();
+            free_ids.pop_back();
+            payloads[id] = item;
+        }
+        insert_slot(id, item->pos);
+        return true;
+    }
+    /// @brief 删除物品项，沿插入时的位置下降到叶子后查找，O(log n)
+    /// @details 物品项的位置需与插入时一致，修改位置请使用 move
+    ///          删除后物品数不超过 node_item_merge 的最上层子树合并为一个叶子
+    /// @param item 物品项
+    /// @return 是否删除，物品项不在树中时为 false
+    bool remove(const std::shared_ptr<ItemInface> &item)
+    {
+        std::vector<uint32_t> path;
+        auto slot = locate(item, path);
+        if (slot == no_slot)
+            return false;
+        detach();
+        auto id = ids[slot];
+        erase(path, slot);
+        payloads[id] = nullptr;
+        free_ids.push_back(id);
+        collect_garbage();
+        return true;
+    }
+    /// @brief 移动物品项到新位置并更新其 pos，编号保持不变
+    /// @details 新位置仍落在原叶子时只更新坐标，否则从原叶子删除后重新插入，必要时扩大根节点
+    /// @param item 物品项
+    /// @param pos 新位置
+    /// @return 是否移动，物品项不在树中、新位置无效或根节点无法扩大到新位置时为 false，此时物品项保持原位置
+    bool move(const std::shared_ptr<ItemInface> &item, const cv::Point2d &pos)
+    {
+        if (is_valid(pos) == false)
+            return false;
+        std::vector<uint32_t> path;
+        auto slot = locate(item, path);
+        if (slot == no_slot)
+            return false;
+        detach();
+        if (nodes[0].rect.contains(pos) && descend(pos) == path.back())
+        {
+            item->pos = pos;
+            xs[slot] = pos.x;
+            ys[slot] = pos.y;
+            for (auto it = path.rbegin(); it != path.rend(); it++)
+                update_node(*it);
+            return true;
+        }
+        // 先扩展根节点再移除，扩展失败时物品项保持原位置
+        if (nodes[0].rect.contains(pos) == false)
+        {
+            if (grow(pos) == false)
+                return false;
+            path.clear();
+            slot = locate(item, path);
+        }
+        auto id = ids[slot];
+        erase(path, slot);
+        item->pos = pos;
+        insert_slot(id, pos);
+        collect_garbage();
+        return true;
+    }
+    /// @brief 整理节点与坐标数组，按遍历顺序重新编号节点并紧凑存放各叶子的槽位，去掉废弃的节点与槽位
+    void compact()
+    {
+        detach();
+        std::vector<Node> packed_nodes;
+        std::vector<double> packed_xs, packed_ys;
+        std::vector<uint32_t> packed_ids;
+        pack(packed_nodes, packed_xs, packed_ys, packed_ids);
+        nodes.assign(std::move(packed_nodes));
+        xs.assign(std::move(packed_xs));
+        ys.assign(std::move(packed_ys));
+        ids.assign(std::move(packed_ids));
+        free_blocks.clear();
+        garbage_slots = 0;
+    }
+
+    /// @brief 根据范围查找物品项
+    /// @param rect 范围
+    /// @return std::vector<std::shared_ptr<ItemInface>> 物品项集合
+    std::vector<std::shared_ptr<ItemInface>> find(const cv::Rect2d &rect) override
+    {
+        std::vector<std::shared_ptr<ItemInface>> result;
+        if (nodes.empty())
+            return result;
+        TraceScope scope("find", "items");
+        visit(rect, [&](const std::shared_ptr<ItemInface> &item)
+              { result.push_back(item); });
+        scope.items(static_cast<int64_t>(result.size()));
+        BuildTrace::add(TraceCounter::items_found, static_cast<int64_t>(result.size()));
+        return result;
+    }
+    /// @brief 遍历范围内的物品项，不分配内存
+    /// @param rect 范围
+    /// @param fn 回调，参数为 const std::shared_ptr<ItemInface> &
+    template <typename F>
+    void visit(const cv::Rect2d &rect, F &&fn) const
+    {
+        if (nodes.empty())
+            return;
+        auto &all = all_payloads();
+        visit_slots(0, rect, [&](uint32_t slot)
+                    {
+                        auto id = ids[slot];
+                        if (id < all.size() && all[id] != nullptr)
+                            fn(all[id]); });
+    }
+    /// @brief 将范围内的物品项写入输出迭代器
+    /// @param rect 范围
+    /// @param out 输出迭代器，元素为 std::shared_ptr<ItemInface>
+    /// @return 写入结束位置
+    template <typename OutputIt>
+    OutputIt find(const cv::Rect2d &rect, OutputIt out) const
+    {
+        visit(rect, [&](const std::shared_ptr<ItemInface> &item)
+              { *out++ = item; });
+        return out;
+    }
+    /// @brief 将范围内的物品编号写入输出迭代器，编号由 item() 获取物品项
+    /// @param rect 范围
+    /// @param out 输出迭代器，元素为 uint32_t
+    /// @return 写入结束位置
+    template <typename OutputIt>
+    OutputIt find_ids(const cv::Rect2d &rect, OutputIt out) const
+    {
+        if (nodes.empty())
+            return out;
+        visit_slots(0, rect, [&](uint32_t slot)
+                    { *out++ = ids[slot]; });
+        return out;
+    }
+    /// @brief 统计范围内的物品项数量，完全落在范围内的子树直接使用其物品数量
+    /// @param rect 范围
+    /// @return
+    size_t count(const cv::Rect2d &rect) const
+    {
+        if (nodes.empty())
+            return 0;
+        return count(0, rect);
+    }
+    /// @brief 批量查找多个范围内的物品编号，每 batch_grain 个范围作为一个任务并行处理
+    /// @details 各任务先写入自己的缓冲区，再按偏移并行拷贝到连续的编号数组
+    ///          每个范围内的编号顺序与 find_ids 一致
+    /// @param rects 范围
+    /// @param thread_count 同时使用的最多线程数，包括调用线程，不大于 1 时在调用线程中执行
+    /// @return BatchResult 偏移与编号，编号由 item() 获取物品项
+    BatchResult find_batch(std::span<const cv::Rect2d> rects, size_t thread_count = std::thread::hardware_concurrency()) const
+    {
+        TraceScope scope("find_batch", "items");
+        BatchResult result;
+        result.offsets.assign(rects.size() + 1, 0);
+        if (nodes.empty() || rects.empty())
+            return result;
+        auto groups = (rects.size() + batch_grain - 1) / batch_grain;
+        std::vector<std::vector<uint32_t>> buffers(groups);
+        auto query = [&](size_t group)
+        {
+            auto &buffer = buffers[group];
+            auto last = std::min(rects.size(), (group + 1) * batch_grain);
+            for (size_t i = group * batch_grain; i < last; i++)
             {
-                if (is_intersect(item->pos))
-                    this->items.push_back(item);
-                // remove item from parent
-                parent->items.remove(item);
+                auto before = buffer.size();
+                visit_slots(0, rects[i], [&](uint32_t slot)
+                            { buffer.push_back(ids[slot]); });
+                result.offsets[i + 1] = buffer.size() - before;
             }
-            item_set_size = this->items.size();
-        }
+        };
+        auto parallel = thread_count > 1 && groups > 1;
+        if (parallel)
+            shared_pool().parallel_for(groups, query, thread_count);
+        else
+            for (size_t group = 0; group < groups; group++)
+                query(group);
+        for (size_t i = 0; i < rects.size(); i++)
+            result.offsets[i + 1] += result.offsets[i];
+        result.ids.resize(result.offsets.back());
+        auto gather = [&](size_t group)
+        {
+            std::copy(buffers[group].begin(), buffers[group].end(), result.ids.begin() + result.offsets[group * batch_grain]);
+        };
+        if (parallel)
+            shared_pool().parallel_for(groups, gather, thread_count);
+        else
+            for (size_t group = 0; group < groups; group++)
+                gather(group);
+        scope.items(static_cast<int64_t>(result.ids.size()));
+        BuildTrace::add(TraceCounter::items_found, static_cast<int64_t>(result.ids.size()));
+        return result;
+    }
+    /// @brief 查找距离位置最近的若干物品项
+    /// @param pos 位置
+    /// @param k 数量
+    /// @return std::vector<std::shared_ptr<ItemInface>> 物品项集合，按距离从近到远排列
+    std::vector<std::shared_ptr<ItemInface>> nearest(const cv::Point2d &pos, size_t k) override
+    {
+        TraceScope scope("nearest", "items");
+        std::vector<std::pair<double, uint32_t>> found;
+        nearest_slots(pos, k, found);
+        return collect(found, scope);
+    }
+    /// @brief 查找与位置距离不超过半径的物品项
+    /// @param pos 位置
+    /// @param radius 半径
+    /// @return std::vector<std::shared_ptr<ItemInface>> 物品项集合，按距离从近到远排列
+    std::vector<std::shared_ptr<ItemInface>> within(const cv::Point2d &pos, double radius) override
+    {
+        TraceScope scope("within", "items");
+        std::vector<std::pair<double, uint32_t>> found;
+        visit_within(pos, radius, [&](uint32_t id, double distance2)
+                     { found.push_back({distance2, id}); });
+        std::sort(found.begin(), found.end());
+        return collect(found, scope);
+    }
+    /// @brief 遍历与位置距离不超过半径的物品，顺序不定，不分配内存
+    /// @param pos 位置
+    /// @param radius 半径
+    /// @param fn 回调，参数为物品编号 uint32_t 与距离的平方 double
+    template <typename F>
+    void visit_within(const cv::Point2d &pos, double radius, F &&fn) const
+    {
+        if (nodes.empty() || radius < 0)
+            return;
+        visit_within(0, pos, radius * radius, fn);
+    }
+    /// @brief 按单元大小查找范围内的聚类，用于缩小显示时代替逐个物品绘制
+    /// @details 与范围相交且边长不超过 min_cell_size 的节点整体作为一个聚类，可能包含范围外的物品；
+    ///          边长更大的叶子中的物品逐个作为聚类。耗时与可见单元数相关，与物品总数无关
+    /// @param rect 范围
+    /// @param min_cell_size 单元边长，不大于 0 时每个物品单独作为聚类
+    /// @return std::vector<Cluster> 聚类
+    std::vector<Cluster> find_clusters(const cv::Rect2d &rect, double min_cell_size) const
+    {
+        TraceScope scope("find_clusters", "items");
+        std::vector<Cluster> result;
+        visit_clusters(rect, min_cell_size, [&](const Cluster &cluster)
+                       { result.push_back(cluster); });
+        scope.items(static_cast<int64_t>(result.size()));
+        return result;
+    }
+    /// @brief 遍历范围内的聚类，不分配内存，划分方式与 find_clusters 一致
+    /// @param rect 范围
+    /// @param min_cell_size 单元边长
+    /// @param fn 回调，参数为 const Cluster &
+    template <typename F>
+    void visit_clusters(const cv::Rect2d &rect, double min_cell_size, F &&fn) const
+    {
+        if (nodes.empty())
+            return;
+        visit_clusters(0, rect, min_cell_size, fn);
+    }
+    /// @brief 按编号获取物品项
+    /// @return 编号超出范围或已删除时为空
+    const std::shared_ptr<ItemInface> &item(uint32_t id) const
+    {
+        static const std::shared_ptr<ItemInface> none;
+        auto &all = all_payloads();
+        if (id >= all.size() || (mapped_positions != nullptr && is_valid(mapped_positions[id]) == false))
+            return none;
+        return all[id];
+    }
+    /// @brief 查找与范围相交的非空叶子节点
+    /// @param rect 范围
+    /// @return std::vector<const Node *> 叶子节点，在树被修改之前有效
+    std::vector<const Node *> find_childs(const cv::Rect2d &rect) const
+    {
+        std::vector<const Node *> result;
+        if (nodes.empty())
+            return result;
+        find_childs(0, rect, result);
+        return result;
+    }
+    /// @brief 获取叶子节点中的物品项
+    /// @param node 叶子节点
+    /// @return
+    std::vector<std::shared_ptr<ItemInface>> node_items(const Node &node) const
+    {
+        std::vector<std::shared_ptr<ItemInface>> items;
+        items.reserve(node.count);
+        for (uint32_t slot = node.begin; slot < node.begin + node.count; slot++)
+            if (auto &payload = item(ids[slot]); payload != nullptr)
+                items.push_back(payload);
+        return items;
+    }
 
-        ~Node() = default;
+public:
+    /// @brief 判断物品项集合是否为空
+    bool empty() override { return size() == 0; }
+    /// @brief 物品项数量
+    size_t size() const { return nodes.empty() ? 0 : nodes[0].size; }
+    /// @brief 节点数量，不包括等待复用的节点
+    size_t node_count() const { return nodes.size() - free_blocks.size() * 4; }
+    /// @brief 根节点范围
+    cv::Rect2d get_rect() const { return nodes.empty() ? cv::Rect2d() : nodes[0].rect; }
 
-    public:
-        cv::Rect2d rect;
-        cv::Point2d center;
-
-    public:
-        std::list<std::shared_ptr<ItemInface>> items;
-        size_t item_set_size = 0;
-        size_t node_count = 1; // 至少会有root节点
-
-    public:
-        size_t node_item_max = 32; // 32;// 512;
-
-    public:
-        bool is_leaf() { return childs.empty(); }
-        bool is_empty() { return items.empty(); }
-        bool is_intersect(const cv::Rect2d &rect) { return (this->rect & rect).area() > 0; }
-        bool is_intersect(const cv::Point2d &pos) { return this->rect.contains(pos); }
-        /// @brief 获取当前节点的物品数量
-        /// @return
-        size_t size() { return items.size(); }
-        /// @brief 获取当前节点包括递归子节点的物品数量
-        /// @return
-        size_t sizes() { return item_set_size; }
-        /// @brief 获取当前节点的子节点数量
-        size_t count() { return childs.size(); }
-        /// @brief 获取当前节点包括递归子节点的子节点数量
-        /// @return
-        size_t counts() { return node_count; }
-
-    public:
-        std::vector<std::shared_ptr<Node>> split()
-        {
-            if (is_leaf() == false)
-                return childs;
-            auto that = this->shared_from_this();
-            top_left = std::make_shared<Node>(that, SplitType::top_left);
-            top_right = std::make_shared<Node>(that, SplitType::top_right);
-            bottom_left = std::make_shared<Node>(that, SplitType::bottom_left);
-            bottom_right = std::make_shared<Node>(that, SplitType::bottom_right);
-            childs = {top_left, top_right, bottom_left, bottom_right};
-            if (items.empty() == false)
-                throw std::runtime_error("Node split error");
-            // 递归到root 增加node_count计数
-            while (that != nullptr)
+private:
+    // 等待并行建立的子树
+    struct Subtree
+    {
+        uint32_t index;
+        uint32_t begin;
+        uint32_t end;
+        int depth;
+    };
+    // 逐层按子节点范围计算象限序号，组成 2 * max_depth 位的 Morton 键，高位为上层
+    // 与插入时使用相同的范围划分，边界上的物品也落在同一子节点
+    // 按分量展开 child_rect 的计算，浮点运算顺序与之相同
+    static uint64_t morton_key(const cv::Rect2d &rect, const cv::Point2d &pos)
+    {
+        uint64_t key = 0;
+        double x = rect.x, y = rect.y, width = rect.width, height = rect.height;
+        for (int depth = 0; depth < max_depth; depth++)
+        {
+            double cx = x + width / 2.0, cy = y + height / 2.0;
+            uint64_t right = pos.x >= cx, bottom = pos.y >= cy;
+            key = (key << 2) | right | (bottom << 1);
+            x = right ? cx : x;
+            y = bottom ? cy : y;
+            width /= 2.0;
+            height /= 2.0;
+        }
+        return key;
+    }
+    // 由排序后的 [begin, end) 建立 out[index] 的子树，tasks 不为空时较小的子树只记录不建立
+    static void build_range(std::vector<Node> &out, const std::vector<std::pair<uint64_t, uint32_t>> &keys, uint32_t index, uint32_t begin, uint32_t end, int depth, std::vector<Subtree> *tasks)
+    {
+        out[index].size = end - begin;
+        if (end - begin <= node_item_max || depth >= max_depth)
+        {
+            out[index].begin = begin;
+            out[index].count = out[index].capacity = end - begin;
+            return;
+        }
+        if (tasks != nullptr && end - begin <= parallel_grain)
+        {
+            tasks->push_back({index, begin, end, depth});
+            return;
+        }
+        auto first = static_cast<uint32_t>(out.size());
+        out[index].child = first;
+        for (uint32_t q = 0; q < 4; q++)
+            out.push_back({child_rect(out[index].rect, q)});
+        // 第 depth 层的象限序号位于键的 2 * (max_depth - 1 - depth) 位
+        int shift = 2 * (max_depth - 1 - depth);
+        uint32_t bounds[5] = {begin, 0, 0, 0, end};
+        for (uint32_t q = 1; q < 4; q++)
+            bounds[q] = static_cast<uint32_t>(std::partition_point(keys.begin() + bounds[q - 1], keys.begin() + end, [&](const std::pair<uint64_t, uint32_t> &key)
+                                                                   { return ((key.first >> shift) & 3) < q; }) -
+                                              keys.begin());
+        for (uint32_t q = 0; q < 4; q++)
+            build_range(out, keys, first + q, bounds[q], bounds[q + 1], depth + 1, tasks);
+    }
+    // 物品位置所在的子节点序号，与子节点范围的半开区间划分一致
+    static uint32_t quadrant(const Node &node, const cv::Point2d &pos)
+    {
+        auto center = node.center();
+        return (pos.x >= center.x ? 1u : 0u) + (pos.y >= center.y ? 2u : 0u);
+    }
+    static cv::Rect2d child_rect(const cv::Rect2d &rect, uint32_t quadrant)
+    {
+        auto size = cv::Size2d(rect.width / 2.0, rect.height / 2.0);
+        auto offset = cv::Point2d(quadrant & 1 ? rect.width / 2 : 0, quadrant & 2 ? rect.height / 2 : 0);
+        return cv::Rect2d(rect.tl() + offset, size);
+    }
+    // 向叶子追加一个物品，容量不足时将叶子的槽位整体搬到数组末尾并加倍容量
+    void append(uint32_t index, double x, double y, uint32_t id)
+    {
+        auto &node = nodes[index];
+        if (node.count == node.capacity)
+        {
+            garbage_slots += node.capacity;
+            auto capacity = std::max<uint32_t>(4, node.capacity * 2);
+            auto begin = static_cast<uint32_t>(xs.size());
+            xs.resize(begin + capacity);
+            ys.resize(begin + capacity);
+            ids.resize(begin + capacity);
+            std::copy_n(xs.begin() + node.begin, node.count, xs.begin() + begin);
+            std::copy_n(ys.begin() + node.begin, node.count, ys.begin() + begin);
+            std::copy_n(ids.begin() + node.begin, node.count, ids.begin() + begin);
+            node.begin = begin;
+            node.capacity = capacity;
+        }
+        auto slot = node.begin + node.count++;
+        xs[slot] = x;
+        ys[slot] = y;
+        ids[slot] = id;
+    }
+    // 将叶子分裂为四个子节点并分配其物品，物品仍集中在一个子节点时继续分裂
+    void split(uint32_t index, int depth)
+    {
+        auto first = allocate_block();
+        for (uint32_t q = 0; q < 4; q++)
+            nodes[first + q] = {child_rect(nodes[index].rect, q)};
+        auto leaf = nodes[index];
+        garbage_slots += leaf.capacity;
+        nodes[index].child = first;
+        nodes[index].begin = nodes[index].count = nodes[index].capacity = 0;
+        for (uint32_t slot = leaf.begin; slot < leaf.begin + leaf.count; slot++)
+        {
+            auto child = first + quadrant(leaf, {xs[slot], ys[slot]});
+            nodes[child].size++;
+            nodes[child].add({xs[slot], ys[slot]});
+            append(child, xs[slot], ys[slot], ids[slot]);
+        }
+        for (uint32_t q = 0; q < 4; q++)
+            if (nodes[first + q].count > node_item_max && depth + 1 < max_depth)
+                split(first + q, depth + 1);
+    }
+    // 按遍历顺序复制可达的节点与叶子槽位，子节点排在父节点之后
+    void pack(std::vector<Node> &out_nodes, std::vector<double> &out_xs, std::vector<double> &out_ys, std::vector<uint32_t> &out_ids) const
+    {
+        if (nodes.empty())
+            return;
+        out_nodes.reserve(node_count());
+        out_xs.reserve(size());
+        out_ys.reserve(size());
+        out_ids.reserve(size());
+        out_nodes.push_back(nodes[0]);
+        std::function<void(uint32_t, uint32_t)> copy = [&](uint32_t index, uint32_t target)
+        {
+            auto &node = nodes[index];
+            if (node.is_leaf())
+            {
+                out_nodes[target].begin = static_cast<uint32_t>(out_xs.size());
+                out_nodes[target].capacity = node.count;
+                out_xs.insert(out_xs.end(), xs.begin() + node.begin, xs.begin() + node.begin + node.count);
+                out_ys.insert(out_ys.end(), ys.begin() + node.begin, ys.begin() + node.begin + node.count);
+                out_ids.insert(out_ids.end(), ids.begin() + node.begin, ids.begin() + node.begin + node.count);
+                return;
+            }
+            auto first = static_cast<uint32_t>(out_nodes.size());
+            out_nodes[target].child = first;
+            for (uint32_t q = 0; q < 4; q++)
+                out_nodes.push_back(nodes[node.child + q]);
+            for (uint32_t q = 0; q < 4; q++)
+                copy(node.child + q, first + q);
+        };
+        copy(0, 0);
+    }
+    // 映射文件中的数组复制为自有存储后才能修改
+    // 打开文件时推迟的物品项创建与已删除编号的收集也在此完成
+    void detach()
+    {
+        if (mapping == nullptr)
+            return;
+        if (saved != nullptr)
+            payloads = all_payloads();
+        saved.reset();
+        // 已删除的编号在文件中的位置为 NaN
+        free_ids.clear();
+        for (uint32_t id = 0; id < payloads.size(); id++)
+            if (is_valid(mapped_positions[id]) == false)
             {
-                that->node_count = that->node_count + 4;
-                that = that->parent;
+                payloads[id] = nullptr;
+                free_ids.push_back(id);
             }
-            return childs;
+        mapped_positions = nullptr;
+        nodes.detach();
+        xs.detach();
+        ys.detach();
+        ids.detach();
+        mapping.reset();
+    }
+    // 按编号存放的全部物品项，未提供物品项打开的树在第一次调用时按文件中的位置创建
+    const std::vector<std::shared_ptr<ItemInface>> &all_payloads() const
+    {
+        if (saved == nullptr)
+            return payloads;
+        std::call_once(saved->once, [&]
+                       {
+                           auto &created = saved->items;
+                           created.resize(saved->count);
+                           for (uint32_t id = 0; id < saved->count; id++)
+                               if (is_valid(saved->positions[id]))
+                                   created[id] = std::make_shared<ItemInface>(saved->positions[id]); });
+        return saved->items;
+    }
+    // 分配四个连续的子节点，优先复用合并留下的节点块
+    uint32_t allocate_block()
+    {
+        if (free_blocks.empty() == false)
+        {
+            auto first = free_blocks.back();
+            free_blocks.pop_back();
+            return first;
         }
-        bool insert(const std::shared_ptr<ItemInface> &item)
+        auto first = static_cast<uint32_t>(nodes.size());
+        nodes.resize(nodes.size() + 4);
+        return first;
+    }
+    static bool is_valid(const cv::Point2d &pos) { return std::isfinite(pos.x) && std::isfinite(pos.y); }
+    // 按位置下降到叶子，path 依次记录经过的节点，包括叶子
+    uint32_t descend(const cv::Point2d &pos, std::vector<uint32_t> *path = nullptr) const
+    {
+        uint32_t index = 0;
+        while (true)
         {
-            if (item == nullptr)
-                return false;
-            // 如果当前节点与物品不相交，直接返回
-            if (is_intersect(item->pos) == false)
+            if (path != nullptr)
+                path->push_back(index);
+            if (nodes[index].is_leaf())
+                return index;
+            index = nodes[index].child + quadrant(nodes[index], pos);
+        }
+    }
+    // 按物品项当前位置查找其槽位，找不到时为 no_slot
+    uint32_t locate(const std::shared_ptr<ItemInface> &item, std::vector<uint32_t> &path) const
+    {
+        if (item == nullptr || nodes.empty() || nodes[0].rect.contains(item->pos) == false)
+            return no_slot;
+        auto &leaf = nodes[descend(item->pos, &path)];
+        for (uint32_t slot = leaf.begin; slot < leaf.begin + leaf.count; slot++)
+            if (this->item(ids[slot]) == item)
+                return slot;
+        return no_slot;
+    }
+    // 位置不在根节点范围内时，以原根节点为一个象限向位置方向加倍根节点范围，直到包含该位置；无法包含时返回 false，树不变
+    // 原根节点整体成为新根节点的子节点，其余三个子节点为空叶子
+    bool grow(const cv::Point2d &pos)
+    {
+        // 先确认能够包含该位置，失败时不修改树
+        auto target = nodes[0].rect;
+        if (cover(target, pos) == false)
+            return false;
+        while (nodes[0].rect.contains(pos) == false)
+        {
+            auto old = nodes[0];
+            auto rect = old.rect;
+            uint32_t q_old = 0;
+            expand(rect, pos, q_old);
+            auto first = allocate_block();
+            for (uint32_t q = 0; q < 4; q++)
+                nodes[first + q] = {child_rect(rect, q)};
+            nodes[first + q_old] = old;
+            nodes[0] = old;
+            nodes[0].rect = rect;
+            nodes[0].child = first;
+            nodes[0].begin = nodes[0].count = nodes[0].capacity = 0;
+        }
+        return true;
+    }
+    // 以原范围为一个象限向位置方向加倍一次，quadrant 为原范围在新范围中的象限序号
+    static bool expand(cv::Rect2d &rect, const cv::Point2d &pos, uint32_t &quadrant)
+    {
+        if (rect.width <= 0 || rect.height <= 0)
+            return false;
+        auto left = pos.x < rect.x;
+        auto up = pos.y < rect.y;
+        cv::Rect2d grown(left ? rect.x - rect.width : rect.x, up ? rect.y - rect.height : rect.y, rect.width * 2, rect.height * 2);
+        if (std::isfinite(grown.width) == false || std::isfinite(grown.height) == false)
+            return false;
+        quadrant = (left ? 1 : 0) + (up ? 2 : 0);
+        rect = grown;
+        return true;
+    }
+    // 加倍范围直到包含位置，位置无效或无法包含时返回 false 且范围不变
+    static bool cover(cv::Rect2d &rect, const cv::Point2d &pos)
+    {
+        if (is_valid(pos) == false)
+            return false;
+        auto grown = rect;
+        uint32_t quadrant = 0;
+        while (grown.contains(pos) == false)
+            if (expand(grown, pos, quadrant) == false)
                 return false;
-            item_set_size++;
-            // 如果当前节点是叶子节点
-            if (is_leaf())
+        rect = grown;
+        return true;
+    }
+    // 按中心点直接选择子节点下降到叶子后追加，超过容量时分裂
+    void insert_slot(uint32_t id, const cv::Point2d &pos)
+    {
+        uint32_t index = 0;
+        int depth = 0;
+        while (nodes[index].is_leaf() == false)
+        {
+            nodes[index].size++;
+            nodes[index].add(pos);
+            index = nodes[index].child + quadrant(nodes[index], pos);
+            depth++;
+        }
+        nodes[index].size++;
+        nodes[index].add(pos);
+        append(index, pos.x, pos.y, id);
+        if (nodes[index].count > node_item_max && depth < max_depth)
+            split(index, depth);
+    }
+    // 用叶子最后一个槽位填补被删除的槽位，再合并物品数过少的最上层子树
+    void erase(const std::vector<uint32_t> &path, uint32_t slot)
+    {
+        auto &leaf = nodes[path.back()];
+        auto last = leaf.begin + leaf.count - 1;
+        xs[slot] = xs[last];
+        ys[slot] = ys[last];
+        ids[slot] = ids[last];
+        leaf.count--;
+        for (auto index : path)
+            nodes[index].size--;
+        // 合并后其下的节点不再使用，只重新计算合并节点及其上层的统计量
+        auto top = path.size() - 1;
+        for (size_t i = 0; i < path.size(); i++)
+            if (nodes[path[i]].is_leaf() == false && nodes[path[i]].size <= node_item_merge)
             {
-                // 直接插入
-                items.push_back(item);
-                // 如果当前节点的物品数量超过阈值
-                if (items.size() > node_item_max)
-                {
-                    // 需要将当前节点分裂
-                    this->split();
-                }
-                return true;
+                merge(path[i]);
+                top = i;
+                break;
             }
-            // 如果当前节点不是叶子节点
-            // 将物品插入到子节点中
-            for (auto &child : childs)
-                if (child->insert(item))
-                    return true;
-            // 如果所有子节点都没有插入成功
-            return false;
+        for (auto i = top + 1; i-- > 0;)
+            update_node(path[i]);
+    }
+    // 由叶子槽位或子节点重新计算节点的坐标和与包围盒
+    void update_node(uint32_t index)
+    {
+        auto &node = nodes[index];
+        node.sum = {0, 0};
+        node.lower = {INFINITY, INFINITY};
+        node.upper = {-INFINITY, -INFINITY};
+        if (node.is_leaf())
+        {
+            for (uint32_t slot = node.begin; slot < node.begin + node.count; slot++)
+                node.add({xs[slot], ys[slot]});
+            return;
+        }
+        for (uint32_t q = 0; q < 4; q++)
+        {
+            auto &child = nodes[node.child + q];
+            node.sum += child.sum;
+            node.lower = {std::min(node.lower.x, child.lower.x), std::min(node.lower.y, child.lower.y)};
+            node.upper = {std::max(node.upper.x, child.upper.x), std::max(node.upper.y, child.upper.y)};
+        }
+    }
+    // 将子树的物品集中到一个新的槽位段，子节点块回收复用
+    void merge(uint32_t index)
+    {
+        auto count = nodes[index].size;
+        auto capacity = std::max<uint32_t>(4, std::bit_ceil(count));
+        auto begin = static_cast<uint32_t>(xs.size());
+        xs.resize(begin + capacity);
+        ys.resize(begin + capacity);
+        ids.resize(begin + capacity);
+        auto slot = begin;
+        visit_all(index, [&](uint32_t from)
+                  {
+                      xs[slot] = xs[from];
+                      ys[slot] = ys[from];
+                      ids[slot] = ids[from];
+                      slot++; });
+        release(index);
+        auto &node = nodes[index];
+        node.child = no_child;
+        node.begin = begin;
+        node.count = count;
+        node.capacity = capacity;
+    }
+    void release(uint32_t index)
+    {
+        auto &node = nodes[index];
+        if (node.is_leaf())
+        {
+            garbage_slots += node.capacity;
+            return;
+        }
+        for (uint32_t q = 0; q < 4; q++)
+            release(node.child + q);
+        free_blocks.push_back(node.child);
+    }
+    void collect_garbage()
+    {
+        if (garbage_slots > garbage_min && garbage_slots > size())
+            compact();
+    }
+
+    // 与 (a & b).area() > 0 等价，不构造交集
+    static bool is_intersect(const cv::Rect2d &a, const cv::Rect2d &b)
+    {
+        return std::min(a.x + a.width, b.x + b.width) - std::max(a.x, b.x) > 0 && std::min(a.y + a.height, b.y + b.height) - std::max(a.y, b.y) > 0;
+    }
+    // 节点范围完全落在查询范围内，节点内的物品都满足半开区间判断
+    static bool is_inside(const cv::Rect2d &node, const cv::Rect2d &rect)
+    {
+        return rect.x <= node.x && node.x + node.width <= rect.x + rect.width && rect.y <= node.y && node.y + node.height <= rect.y + rect.height;
+    }
+    // 遍历范围内物品的槽位
+    template <typename F>
+    void visit_slots(uint32_t index, const cv::Rect2d &rect, F &&fn) const
+    {
+        auto &node = nodes[index];
+        if (is_intersect(node.rect, rect) == false)
+            return;
+        if (is_inside(node.rect, rect))
+        {
+            visit_all(index, fn);
+            return;
         }
-        std::vector<std::shared_ptr<ItemInface>> find(const cv::Rect2d &rect)
+        if (node.is_leaf())
+        {
+            visit_leaf(node, rect, fn);
+            return;
+        }
+        for (uint32_t q = 0; q < 4; q++)
+            visit_slots(node.child + q, rect, fn);
+    }
+    // 逐块判断叶子槽位是否在范围内，判断部分没有分支，连续坐标可由编译器向量化
+    // 与 rect.contains 的半开区间判断一致
+    template <typename F>
+    void visit_leaf(const Node &node, const cv::Rect2d &rect, F &&fn) const
+    {
+        constexpr uint32_t block = 16;
+        const double x0 = rect.x, x1 = rect.x + rect.width, y0 = rect.y, y1 = rect.y + rect.height;
+        const double *px = xs.data(), *py = ys.data();
+        uint8_t inside[block];
+        for (uint32_t first = node.begin, end = node.begin + node.count; first < end; first += block)
+        {
+            auto n = std::min(block, end - first);
+            for (uint32_t i = 0; i < n; i++)
+                inside[i] = static_cast<uint8_t>((x0 <= px[first + i]) & (px[first + i] < x1) & (y0 <= py[first + i]) & (py[first + i] < y1));
+            for (uint32_t i = 0; i < n; i++)
+                if (inside[i])
+                    fn(first + i);
+        }
+    }
+    // 遍历子树全部物品的槽位，不做范围判断
+    template <typename F>
+    void visit_all(uint32_t index, F &&fn) const
+    {
+        auto &node = nodes[index];
+        if (node.is_leaf())
+        {
+            for (uint32_t slot = node.begin; slot < node.begin + node.count; slot++)
+                fn(slot);
+            return;
+        }
+        for (uint32_t q = 0; q < 4; q++)
+            if (nodes[node.child + q].size > 0)
+                visit_all(node.child + q, fn);
+    }
+    template <typename F>
+    void visit_clusters(uint32_t index, const cv::Rect2d &rect, double min_cell_size, F &fn) const
+    {
+        auto &node = nodes[index];
+        if (node.size == 0 || is_intersect(node.rect, rect) == false)
+            return;
+        if (std::max(node.rect.width, node.rect.height) <= min_cell_size)
+        {
+            Cluster cluster{node.centroid(), node.bounds(), node.size};
+            if (node.size == 1)
+                visit_all(index, [&](uint32_t slot)
+                          { cluster.id = ids[slot]; });
+            fn(cluster);
+            return;
+        }
+        if (node.is_leaf())
+        {
+            visit_leaf(node, rect, [&](uint32_t slot)
+                       {
+                           cv::Point2d pos(xs[slot], ys[slot]);
+                           fn(Cluster{pos, cv::Rect2d(pos, cv::Size2d()), 1, ids[slot]}); });
+            return;
+        }
+        for (uint32_t q = 0; q < 4; q++)
+            visit_clusters(node.child + q, rect, min_cell_size, fn);
+    }
+    // 位置到节点范围的最短距离与最远距离的平方
+    static double min_distance2(const cv::Rect2d &rect, const cv::Point2d &pos)
+    {
+        auto dx = std::max({rect.x - pos.x, 0.0, pos.x - (rect.x + rect.width)});
+        auto dy = std::max({rect.y - pos.y, 0.0, pos.y - (rect.y + rect.height)});
+        return dx * dx + dy * dy;
+    }
+    static double max_distance2(const cv::Rect2d &rect, const cv::Point2d &pos)
+    {
+        auto dx = std::max(std::abs(pos.x - rect.x), std::abs(rect.x + rect.width - pos.x));
+        auto dy = std::max(std::abs(pos.y - rect.y), std::abs(rect.y + rect.height - pos.y));
+        return dx * dx + dy * dy;
+    }
+    double distance2(uint32_t slot, const cv::Point2d &pos) const
+    {
+        auto dx = xs[slot] - pos.x;
+        auto dy = ys[slot] - pos.y;
+        return dx * dx + dy * dy;
+    }
+    template <typename F>
+    void visit_within(uint32_t index, const cv::Point2d &pos, double radius2, F &fn) const
+    {
+        auto &node = nodes[index];
+        if (node.size == 0 || min_distance2(node.rect, pos) > radius2)
+            return;
+        if (max_distance2(node.rect, pos) <= radius2)
         {
-            std::vector<std::shared_ptr<ItemInface>> rect_items;
-            // 如果当前节点与范围不相交，直接返回
-            if (is_intersect(rect) == false)
-                return rect_items;
-            // 如果当前节点是叶子节点
-            if (is_leaf())
+            visit_all(index, [&](uint32_t slot)
+                      { fn(ids[slot], distance2(slot, pos)); });
+            return;
+        }
+        if (node.is_leaf())
+        {
+            for (uint32_t slot = node.begin; slot < node.begin + node.count; slot++)
+                if (auto d = distance2(slot, pos); d <= radius2)
+                    fn(ids[slot], d);
+            return;
+        }
+        for (uint32_t q = 0; q < 4; q++)
+            visit_within(node.child + q, pos, radius2, fn);
+    }
+    // 最佳优先遍历：节点按最短距离放入小顶堆，候选物品保存在容量为 k 的大顶堆中
+    // 堆顶节点的最短距离不小于第 k 近物品的距离时结束，结果为按距离升序的 (距离平方, 编号)
+    void nearest_slots(const cv::Point2d &pos, size_t k, std::vector<std::pair<double, uint32_t>> &found) const
+    {
+        if (nodes.empty() || k == 0 || size() == 0)
+            return;
+        found.reserve(std::min(k, size()));
+        std::vector<std::pair<double, uint32_t>> queue;
+        auto closer = std::greater<std::pair<double, uint32_t>>();
+        queue.push_back({min_distance2(nodes[0].rect, pos), 0});
+        while (queue.empty() == false)
+        {
+            std::pop_heap(queue.begin(), queue.end(), closer);
+            auto [bound, index] = queue.back();
+            queue.pop_back();
+            if (found.size() == k && bound >= found.front().first)
+                break;
+            auto &node = nodes[index];
+            if (node.is_leaf())
             {
-                // 如果当前节点范围完全包含在范围内，直接返回当前节点的物品集合
-                if (rect.contains(rect.tl()) && rect.contains(rect.br()))
+                for (uint32_t slot = node.begin; slot < node.begin + node.count; slot++)
                 {
-                    rect_items.insert(rect_items.end(), items.begin(), items.end());
-                    return rect_items;
+                    auto d = distance2(slot, pos);
+                    if (found.size() < k)
+                    {
+                        found.push_back({d, ids[slot]});
+                        std::push_heap(found.begin(), found.end());
+                    }
+                    else if (d < found.front().first)
+                    {
+                        std::pop_heap(found.begin(), found.end());
+                        found.back() = {d, ids[slot]};
+                        std::push_heap(found.begin(), found.end());
+                    }
                 }
-                // 将范围与物品相交的物品插入到结果中
-                for (auto &item : items)
-                    if (rect.contains(item->pos))
-                        rect_items.push_back(item);
-                return rect_items;
+                continue;
+            }
+            for (uint32_t q = 0; q < 4; q++)
+            {
+                auto &child = nodes[node.child + q];
+                if (child.size == 0)
+                    continue;
+                auto d = min_distance2(child.rect, pos);
+                if (found.size() == k && d >= found.front().first)
+                    continue;
+                queue.push_back({d, node.child + q});
+                std::push_heap(queue.begin(), queue.end(), closer);
             }
-            // 如果当前节点不是叶子节点
-            // 将范围与子节点相交的子节点的物品插入到结果中
-            for (auto &child : childs)
-                if (child->is_intersect(rect))
-                {
-                    auto child_items = child->find(rect);
-                    rect_items.insert(rect_items.end(), child_items.begin(), child_items.end());
-                }
-            return rect_items;
-        }
-        /// @brief 查找范围内的递归子节点
-        /// @param rect 范围
-        /// @return std::list<std::shared_ptr<Node>> 子节点集合
-        std::list<std::shared_ptr<Node>> find_childs(const cv::Rect2d &rect)
-        {
-            if (is_intersect(rect) == false)
-                return {};
-            if (is_leaf() && items.empty() == false)
-                return {this->shared_from_this()};
-            std::list<std::shared_ptr<Node>> childs;
-            for (auto &child : this->childs)
-                if (child->is_intersect(rect))
-                {
-                    auto child_childs = child->find_childs(rect);
-                    childs.insert(childs.end(), child_childs.begin(), child_childs.end());
-                }
-            return childs;
         }
-
-    public:
-        std::shared_ptr<Node> parent;
-        std::shared_ptr<Node> top_left;
-        std::shared_ptr<Node> top_right;
-        std::shared_ptr<Node> bottom_left;
-        std::shared_ptr<Node> bottom_right;
-        std::vector<std::shared_ptr<Node>> childs;
-        // = {top_left, top_right, bottom_left, bottom_right};
-    };
-    std::shared_ptr<Node> root;
-
-public:
-    std::vector<std::shared_ptr<ItemInface>> find(const cv::Rect2d &rect) override
+        std::sort_heap(found.begin(), found.end());
+    }
+    std::vector<std::shared_ptr<ItemInface>> collect(const std::vector<std::pair<double, uint32_t>> &found, TraceScope &scope) const
     {
-        if (root == nullptr)
-            return {};
-        return root->find(rect);
+        std::vector<std::shared_ptr<ItemInface>> result;
+        result.reserve(found.size());
+        for (auto &[distance, id] : found)
+            if (auto &payload = item(id); payload != nullptr)
+                result.push_back(payload);
+        scope.items(static_cast<int64_t>(result.size()));
+        BuildTrace::add(TraceCounter::items_found, static_cast<int64_t>(result.size()));
+        return result;
+    }
+    size_t count(uint32_t index, const cv::Rect2d &rect) const
+    {
+        auto &node = nodes[index];
+        if (node.size == 0 || is_intersect(node.rect, rect) == false)
+            return 0;
+        if (is_inside(node.rect, rect))
+            return node.size;
+        size_t result = 0;
+        if (node.is_leaf())
+        {
+            const double x0 = rect.x, x1 = rect.x + rect.width, y0 = rect.y, y1 = rect.y + rect.height;
+            for (uint32_t slot = node.begin; slot < node.begin + node.count; slot++)
+                result += (x0 <= xs[slot]) & (xs[slot] < x1) & (y0 <= ys[slot]) & (ys[slot] < y1);
+            return result;
+        }
+        for (uint32_t q = 0; q < 4; q++)
+            result += count(node.child + q, rect);
+        return result;
     }
-    std::list<std::shared_ptr<Node>> find_childs(const cv::Rect2d &rect)
+    void find_childs(uint32_t index, const cv::Rect2d &rect, std::vector<const Node *> &result) const
     {
-        if (root == nullptr)
-            return {};
-        return root->find_childs(rect);
+        auto &node = nodes[index];
+        if (is_intersect(node.rect, rect) == false)
+            return;
+        if (node.is_leaf())
+        {
+            if (node.count > 0)
+                result.push_back(&node);
+            return;
+        }
+        for (uint32_t q = 0; q < 4; q++)
+            find_childs(node.child + q, rect, result);
     }
 
 public:
-    void cout(std::shared_ptr<Node> node = nullptr, int depth = 0)
+    void cout(uint32_t index = 0, int depth = 0) const
     {
-        if (node == nullptr && depth != 0)
+        if (index >= nodes.size())
             return;
-        if (node == nullptr)
-            node = root;
-
-        auto space = std::string();
-        for (int i = 0; i < depth; i++)
-            space += "\t";
-        std::cout << space << "node: " << node->rect << std::endl;
-        std::cout << space << "node size: " << node->item_set_size << std::endl;
-        std::cout << space << "node node count: " << node->counts() << std::endl;
-        for (auto &item : node->items)
-            std::cout << space << "\titem: " << item->pos << std::endl;
-        for (auto &child : node->childs)
-            cout(child, depth + 1);
-    }
-    void print()
+        auto &node = nodes[index];
+        auto space = std::string(depth, '\t');
+        std::cout << space << "node: " << node.rect << std::endl;
+        std::cout << space << "node size: " << node.size << std::endl;
+        for (uint32_t slot = node.begin; slot < node.begin + node.count; slot++)
+            std::cout << space << "\titem: " << cv::Point2d(xs[slot], ys[slot]) << std::endl;
+        if (node.is_leaf() == false)
+            for (uint32_t q = 0; q < 4; q++)
+                cout(node.child + q, depth + 1);
+    }
+    void print() const
     {
+        if (nodes.empty())
+            return;
         double scale = 15;
-        auto size = cv::Size(static_cast<int>(root->rect.size().width / scale), static_cast<int>(root->rect.size().height / scale));
+        auto &root = nodes[0];
+        auto size = cv::Size(static_cast<int>(root.rect.size().width / scale), static_cast<int>(root.rect.size().height / scale));
         cv::Mat img = cv::Mat::zeros(size, CV_8UC3);
-        auto pos_offset = cv::Point2d(-root->rect.tl()) / scale;
+        auto pos_offset = cv::Point2d(-root.rect.tl()) / scale;
         int count = 0;
         int max_depth = 0;
         // 遍历树
-        std::function<void(std::shared_ptr<Node>, int)> print_node = [&](std::shared_ptr<Node> node, int depth = 0)
+        std::function<void(uint32_t, int)> print_node = [&](uint32_t index, int depth)
         {
-            if (node == nullptr)
-                return;
+            auto &node = nodes[index];
             count++;
-
-            print_node(node->top_left, depth + 1);
-            print_node(node->top_right, depth + 1);
-            print_node(node->bottom_left, depth + 1);
-            print_node(node->bottom_right, depth + 1);
-            if (node->is_leaf() == false)
+            if (node.is_leaf() == false)
+            {
+                for (uint32_t q = 0; q < 4; q++)
+                    print_node(node.child + q, depth + 1);
                 return;
-
+            }
             if (depth > max_depth)
                 max_depth = depth;
             // 绘制树
-            auto rect = cv::Rect(static_cast<int>(node->rect.x / scale), static_cast<int>(node->rect.y / scale), static_cast<int>(node->rect.width / scale), static_cast<int>(node->rect.height / scale)) + cv::Point(pos_offset);
+            auto rect = cv::Rect(static_cast<int>(node.rect.x / scale), static_cast<int>(node.rect.y / scale), static_cast<int>(node.rect.width / scale), static_cast<int>(node.rect.height / scale)) + cv::Point(pos_offset);
             cv::rectangle(img, rect, cv::Scalar(255, 255, depth * 8), 1, cv ::LINE_AA);
-            cv::circle(img, node->center / scale + pos_offset, 1, cv::Scalar(0, depth * 8, 255), 1, cv::LINE_AA);
-            for (auto &item : node->items)
-                cv::circle(img, item->pos / scale + pos_offset, 1, cv::Scalar(0, 255, depth * 8), 1, cv::LINE_AA);
-            cv::imshow("tree", img);
-            cv::waitKey(1);
+            cv::circle(img, node.center() / scale + pos_offset, 1, cv::Scalar(0, depth * 8, 255), 1, cv::LINE_AA);
+            for (uint32_t slot = node.begin; slot < node.begin + node.count; slot++)
+                cv::circle(img, cv::Point2d(xs[slot], ys[slot]) / scale + pos_offset, 1, cv::Scalar(0, 255, depth * 8), 1, cv::LINE_AA);
         };
-        print_node(root, 0);
+        print_node(0, 0);
+        cv::imshow("tree", img);
+        cv::waitKey(1);
 
         std::cout << "node count: " << count << std::endl;
         std::cout << "max depth: " << max_depth << std::endl;
     }
+
+private:
+    // 节点数组，下标 0 为根节点
+    FlatArray<Node> nodes;
+    // 叶子槽位中的物品坐标与编号，分裂或扩容后旧槽位不再使用
+    FlatArray<double> xs;
+    FlatArray<double> ys;
+    FlatArray<uint32_t> ids;
+    // 加载的映射文件，数组引用其中的内存时不为空
+    std::shared_ptr<MappedFile> mapping;
+    // 按编号存放的物品项，已删除的编号为空并记录在 free_ids 中等待复用
+    std::vector<std::shared_ptr<ItemInface>> payloads;
+    std::vector<uint32_t> free_ids;
+    // 未提供物品项打开的树，物品项在第一次需要时创建一次，复制的树共享同一份结果，修改前复制到 payloads
+    struct SavedPayloads
+    {
+        SavedPayloads(std::shared_ptr<MappedFile> mapping, const cv::Point2d *positions, uint32_t count)
+            : mapping(std::move(mapping)), positions(positions), count(count) {}
+        std::shared_ptr<MappedFile> mapping;
+        const cv::Point2d *positions;
+        uint32_t count;
+        std::once_flag once;
+        std::vector<std::shared_ptr<ItemInface>> items;
+    };
+    std::shared_ptr<SavedPayloads> saved;
+    // 映射文件中按编号存放的物品位置，已删除的编号为 NaN，修改前有效
+    const cv::Point2d *mapped_positions = nullptr;
+    // 合并后等待复用的子节点块的第一个下标
+    std::vector<uint32_t> free_blocks;
+    // 不再使用的槽位数量
+    size_t garbage_slots = 0;
 };
@@ -0,0 +1,145 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// 打包区块文件格式，所有字段为小端序
+// [PackedTileHeader][PackedTileEntry * tile_count][区块数据...]
+// 区块数据按页对齐，raw 编码的区块可以直接映射为 cv::Mat 使用
+
+/// @brief 区块数据编码方式
+enum class PackedTileEncoding : uint32_t
+{
+    raw = 0, // 未压缩的像素数据，行连续
+    png = 1  // 低压缩级别的 PNG，读取时解码
+};
+
+/// @brief 打包区块文件头
+struct PackedTileHeader
+{
+    char magic[4] = {'B', 'M', 'R', 'P'};
+    uint32_t version = 1;
+    uint32_t tile_size = 2048;
+    uint32_t channels = 3;
+    uint32_t tile_count = 0;
+    int32_t map_origin_x = 0;
+    int32_t map_origin_y = 0;
+    int32_t origin_index_x = 0;
+    int32_t origin_index_y = 0;
+    uint32_t reserved = 0;
+    uint64_t entry_offset = sizeof(PackedTileHeader);
+
+    bool is_valid() const { return magic[0] == 'B' && magic[1] == 'M' && magic[2] == 'R' && magic[3] == 'P' && version == 1; }
+};
+
+/// @brief 打包区块文件中单个区块的索引项
+struct PackedTileEntry
+{
+    int32_t index_x = 0;
+    int32_t index_y = 0;
+    PackedTileEncoding encoding = PackedTileEncoding::raw;
+    uint32_t reserved = 0;
+    uint64_t offset = 0;
+    uint64_t size = 0;
+};
+
+// 区块数据对齐到页大小
+constexpr uint64_t packed_tile_alignment = 4096;
+
+/// @brief 只读内存映射文件
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::filesystem::path &path)
+    {
+#ifdef _WIN32
+        file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return;
+        LARGE_INTEGER file_size;
+        if (GetFileSizeEx(file, &file_size) == FALSE || file_size.QuadPart == 0)
+            return;
+        mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping == nullptr)
+            return;
+        auto view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (view == nullptr)
+            return;
+        bytes = static_cast<const unsigned char *>(view);
+        length = static_cast<size_t>(file_size.QuadPart);
+#else
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+            return;
+        auto view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (view == MAP_FAILED)
+            return;
+        bytes = static_cast<const unsigned char *>(view);
+        length = static_cast<size_t>(st.st_size);
+#endif
+    }
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (bytes != nullptr)
+            UnmapViewOfFile(bytes);
+        if (mapping != nullptr)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+#else
+        if (bytes != nullptr)
+            munmap(const_cast<unsigned char *>(bytes), length);
+        if (fd >= 0)
+            close(fd);
+#endif
+    }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+public:
+    const unsigned char *data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char *bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+/// @brief 区块网格坐标的 Morton 编码，用于按空间局部性排列区块
+/// @param x 非负网格列
+/// @param y 非负网格行
+/// @return
+inline uint64_t morton_code(uint32_t x, uint32_t y)
+{
+    auto spread = [](uint64_t v)
+    {
+        v &= 0xffffffff;
+        v = (v | (v << 16)) & 0x0000ffff0000ffff;
+        v = (v | (v << 8)) & 0x00ff00ff00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0f;
+        v = (v | (v << 2)) & 0x3333333333333333;
+        v = (v | (v << 1)) & 0x5555555555555555;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+
+// 地图区块的像素格式，作为 BasicBlockMapResource 的模板参数
+// 区块在加载时一次转换为目标格式，之后的查询与合成都只处理目标格式的通道
+
+/// @brief 单通道灰度，内存与带宽约为 BGR 的三分之一，供只需要灰度的匹配使用
+struct PixelGray
+{
+    static constexpr int channels = 1;
+    static constexpr int type = CV_8UC1;
+    static constexpr int imread_flags = cv::IMREAD_GRAYSCALE;
+    // 输出图片的行对齐字节数，0 表示不要求
+    static constexpr size_t row_alignment = 0;
+};
+
+/// @brief 三通道 BGR，与 imread 默认格式一致
+struct PixelBGR
+{
+    static constexpr int channels = 3;
+    static constexpr int type = CV_8UC3;
+    static constexpr int imread_flags = cv::IMREAD_COLOR;
+    static constexpr size_t row_alignment = 0;
+};
+
+/// @brief 四通道 BGRA，输出图片每行起始地址按 16 字节对齐，便于向量化拷贝
+struct PixelBGRA
+{
+    static constexpr int channels = 4;
+    static constexpr int type = CV_8UC4;
+    static constexpr int imread_flags = cv::IMREAD_UNCHANGED;
+    static constexpr size_t row_alignment = 16;
+};
+
+/// @brief 将 1、3、4 通道图片转换为目标格式，通道数与位深已一致时直接返回原图片
+/// @details IMREAD_UNCHANGED 会按原位深读取 16 位 PNG，先缩放为 8 位；其他位深按读取失败处理
+/// @tparam Format 目标像素格式
+/// @param source 源图片
+/// @return
+template <typename Format>
+cv::Mat convert_pixel_format(const cv::Mat &source)
+{
+    if (source.empty())
+        return source;
+    cv::Mat image = source;
+    if (source.depth() == CV_16U)
+        source.convertTo(image, CV_MAKETYPE(CV_8U, source.channels()), 1.0 / 257);
+    else if (source.depth() != CV_8U)
+        return cv::Mat();
+    if (image.channels() == Format::channels)
+        return image;
+    int code = -1;
+    switch (image.channels() * 10 + Format::channels)
+    {
+    case 13:
+        code = cv::COLOR_GRAY2BGR;
+        break;
+    case 14:
+        code = cv::COLOR_GRAY2BGRA;
+        break;
+    case 31:
+        code = cv::COLOR_BGR2GRAY;
+        break;
+    case 34:
+        code = cv::COLOR_BGR2BGRA;
+        break;
+    case 41:
+        code = cv::COLOR_BGRA2GRAY;
+        break;
+    case 43:
+        code = cv::COLOR_BGRA2BGR;
+        break;
+    default:
+        return cv::Mat(); // 不支持的通道数按读取失败处理
+    }
+    cv::Mat converted;
+    cv::cvtColor(image, converted, code);
+    return converted;
+}
@@ -0,0 +1,150 @@
+#pragma once
+#include <queue>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <future>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+/// @brief 固定线程数的任务线程池
+class ThreadPool
+{
+public:
+    ThreadPool(size_t thread_count = std::thread::hardware_concurrency())
+    {
+        if (thread_count == 0)
+            thread_count = 1;
+        for (size_t i = 0; i < thread_count; i++)
+            workers.emplace_back([this]
+                                 { work(); });
+    }
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        for (auto &worker : workers)
+            worker.join();
+    }
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+public:
+    /// @brief 提交任务
+    /// @param task 可调用对象，允许只可移动
+    /// @return std::future 任务结果
+    template <typename F>
+    auto submit(F &&task) -> std::future<std::invoke_result_t<std::decay_t<F>>>
+    {
+        using result_t = std::invoke_result_t<std::decay_t<F>>;
+        auto packaged = std::make_shared<std::packaged_task<result_t()>>(std::forward<F>(task));
+        auto future = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace([packaged]
+                          { (*packaged)(); });
+        }
+        condition.notify_one();
+        return future;
+    }
+    /// @brief 并行执行 fn(0) 到 fn(count - 1)，全部完成后返回
+    /// @details 调用线程也参与执行，工作线程全部繁忙或在线程池任务中嵌套调用时也不会死锁
+    ///          任务抛出异常时剩余序号不再执行，等待已开始的任务结束后在调用线程重新抛出第一个异常
+    /// @param count 任务数量
+    /// @param fn 任务函数，参数为任务序号
+    /// @param max_threads 同时执行的最多线程数，包括调用线程
+    template <typename F>
+    void parallel_for(size_t count, F &&fn, size_t max_threads = SIZE_MAX)
+    {
+        struct State
+        {
+            std::atomic<size_t> next = 0;
+            std::atomic<size_t> done = 0;
+            std::atomic<bool> failed = false;
+            std::exception_ptr error;
+            std::mutex mutex;
+            std::condition_variable condition;
+        };
+        auto state = std::make_shared<State>();
+        // 晚于返回才开始执行的辅助任务取不到序号，不会再访问 fn
+        auto run = [state, count, &fn]
+        {
+            for (size_t i = state->next++; i < count; i = state->next++)
+            {
+                // 已取的序号无论是否执行都要计数，调用线程据此等待所有访问 fn 的任务结束
+                if (state->failed == false)
+                {
+                    try
+                    {
+                        fn(i);
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard<std::mutex> lock(state->mutex);
+                        if (state->error == nullptr)
+                            state->error = std::current_exception();
+                        state->failed = true;
+                    }
+                }
+                if (++state->done == count)
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->condition.notify_all();
+                }
+            }
+        };
+        for (size_t i = 1; i < std::min({count, workers.size() + 1, std::max<size_t>(max_threads, 1)}); i++)
+            submit(run);
+        run();
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->condition.wait(lock, [&]
+                              { return state->done == count; });
+        if (state->error != nullptr)
+            std::rethrow_exception(state->error);
+    }
+    /// @brief 获取工作线程数量
+    /// @return
+    size_t size() const { return workers.size(); }
+
+private:
+    void work()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this]
+                               { return stopping || tasks.empty() == false; });
+                if (stopping && tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping = false;
+};
+
+/// @brief 进程内共享的常驻线程池，地图资源的并行合成与四叉树的批量建立、批量查询都使用它
+/// @details parallel_for 的调用线程也参与执行，嵌套调用与多个调用方同时使用都不会死锁
+inline ThreadPool &shared_pool()
+{
+    static ThreadPool pool;
+    return pool;
+}
@@ -0,0 +1,425 @@
+#include <chrono>
+#include <random>
+#include <iomanip>
+#include <iostream>
+#include "BlockMapResource.h"
+#include "MapItemSet.h"
+#include <meojson/include/json.hpp>
+
+// 使用内存中合成的区块与物品点的基准测试，不依赖地图资源与平台路径
+// 用法: benchmark [--grid N] [--seed S] [--repeat R] [--json 输出文件] [--quick]
+// 每项结果输出一行到标准输出，--json 时同时写出机器可读的结果，便于比较不同提交
+// 区块图片写到系统临时目录下，测试结束后删除
+
+namespace
+{
+    using clock = std::chrono::steady_clock;
+
+    struct Options
+    {
+        int grid = 6;
+        uint32_t seed = 20230901;
+        size_t repeat = 200;
+        bool quick = false;
+        std::filesystem::path json_file;
+    };
+
+    /// @brief 单项测试的耗时统计，单位微秒
+    struct Stats
+    {
+        size_t samples = 0;
+        double mean = 0;
+        double median = 0;
+        double p95 = 0;
+        double min = 0;
+    };
+
+    template <typename F>
+    Stats measure(size_t repeat, F &&fn)
+    {
+        std::vector<double> samples(std::max<size_t>(repeat, 1));
+        for (auto &sample : samples)
+        {
+            auto start = clock::now();
+            fn();
+            sample = std::chrono::duration<double, std::micro>(clock::now() - start).count();
+        }
+        Stats stats;
+        stats.samples = samples.size();
+        stats.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / static_cast<double>(samples.size());
+        std::sort(samples.begin(), samples.end());
+        stats.min = samples.front();
+        stats.median = samples[samples.size() / 2];
+        stats.p95 = samples[std::min(samples.size() - 1, samples.size() * 95 / 100)];
+        return stats;
+    }
+
+    /// @brief 收集结果，同时输出到标准输出与 json
+    class Recorder
+    {
+    public:
+        void add(const std::string &group, const std::string &name, int64_t size, const Stats &stats)
+        {
+            std::cout << std::left << std::setw(14) << group << std::setw(22) << name << std::right << std::setw(10) << size
+                      << std::setw(8) << stats.samples << std::fixed << std::setprecision(1)
+                      << std::setw(14) << stats.mean << std::setw(14) << stats.median << std::setw(14) << stats.p95 << std::endl;
+            results.emplace_back(json::object{
+                {"group", group},
+                {"case", name},
+                {"size", static_cast<long long>(size)},
+                {"samples", static_cast<unsigned long long>(stats.samples)},
+                {"mean_us", stats.mean},
+                {"median_us", stats.median},
+                {"p95_us", stats.p95},
+                {"min_us", stats.min}});
+        }
+        static void print_header()
+        {
+            std::cout << std::left << std::setw(14) << "group" << std::setw(22) << "case" << std::right << std::setw(10) << "size"
+                      << std::setw(8) << "n" << std::setw(14) << "mean us" << std::setw(14) << "median us" << std::setw(14) << "p95 us" << std::endl;
+        }
+        bool save(const std::filesystem::path &file, const Options &options) const
+        {
+            json::object root{
+                {"seed", static_cast<unsigned long long>(options.seed)},
+                {"grid", options.grid},
+                {"repeat", static_cast<unsigned long long>(options.repeat)},
+                {"results", results}};
+            std::ofstream out(file);
+            out << json::value(root).format();
+            return out.good();
+        }
+
+    private:
+        json::array results;
+    };
+
+    // ------------------------------------------------------------------
+    // 合成区块
+
+    /// @brief 生成区块网格，中心椭圆内为纹理区块，外侧为单色海洋区块，四角缺失，接近真实地图的形状
+    std::vector<std::pair<cv::Point, cv::Mat>> make_tiles(int grid, std::mt19937 &rng)
+    {
+        std::vector<std::pair<cv::Point, cv::Mat>> tiles;
+        double r = grid / 2.0;
+        for (int x = 0; x < grid; x++)
+            for (int y = 0; y < grid; y++)
+            {
+                double dx = (x + 0.5 - r) / r;
+                double dy = (y + 0.5 - r) / r;
+                double d = dx * dx + dy * dy;
+                if (d > 1.6)
+                    continue;
+                cv::Point index(x - grid / 2, y - grid / 2);
+                if (d > 0.8)
+                {
+                    tiles.emplace_back(index, cv::Mat(2048, 2048, CV_8UC3, cv::Scalar(120, 80, 30)));
+                    continue;
+                }
+                // 低分辨率噪声放大得到连续纹理，避免纯随机像素让编码器失去意义
+                cv::Mat small(64, 64, CV_8UC3);
+                cv::randu(small, cv::Scalar::all(0), cv::Scalar::all(255));
+                cv::Mat tile;
+                cv::resize(small, tile, cv::Size(2048, 2048), 0, 0, cv::INTER_CUBIC);
+                tile += cv::Scalar(static_cast<double>(rng() % 32), static_cast<double>(rng() % 32), static_cast<double>(rng() % 32));
+                tiles.emplace_back(index, tile);
+            }
+        return tiles;
+    }
+
+    // ------------------------------------------------------------------
+    // 合成物品点
+
+    enum class Distribution
+    {
+        uniform,
+        clustered,
+        realistic
+    };
+
+    const char *to_string(Distribution distribution)
+    {
+        switch (distribution)
+        {
+        case Distribution::uniform:
+            return "uniform";
+        case Distribution::clustered:
+            return "clustered";
+        default:
+            return "realistic";
+        }
+    }
+
+    /// @brief 生成物品点
+    /// @details uniform 在范围内均匀分布；clustered 围绕少量中心正态分布；
+    ///          realistic 由大小不一的聚集区、沿路径分布的点、稀疏散点和同一位置的重复点混合而成
+    std::vector<std::shared_ptr<ItemInface>> make_items(Distribution distribution, size_t count, const cv::Rect2d &rect, std::mt19937 &rng)
+    {
+        std::uniform_real_distribution<double> ux(rect.x, rect.x + rect.width);
+        std::uniform_real_distribution<double> uy(rect.y, rect.y + rect.height);
+        auto clamp = [&](cv::Point2d p)
+        { return cv::Point2d(std::clamp(p.x, rect.x, rect.x + rect.width - 1), std::clamp(p.y, rect.y, rect.y + rect.height - 1)); };
+
+        std::vector<std::shared_ptr<ItemInface>> items;
+        items.reserve(count);
+        if (distribution == Distribution::uniform)
+        {
+            for (size_t i = 0; i < count; i++)
+                items.push_back(std::make_shared<ItemInface>(cv::Point2d(ux(rng), uy(rng))));
+            return items;
+        }
+        std::vector<cv::Point2d> centers(std::max<size_t>(count / 200, 1));
+        std::vector<double> sigmas(centers.size());
+        std::uniform_real_distribution<double> usigma(50, 600);
+        for (size_t i = 0; i < centers.size(); i++)
+        {
+            centers[i] = cv::Point2d(ux(rng), uy(rng));
+            sigmas[i] = distribution == Distribution::clustered ? 300 : usigma(rng);
+        }
+        std::normal_distribution<double> normal(0, 1);
+        std::uniform_real_distribution<double> unit(0, 1);
+        for (size_t i = 0; i < count; i++)
+        {
+            double pick = distribution == Distribution::clustered ? 0 : unit(rng);
+            cv::Point2d pos;
+            if (pick < 0.6)
+            {
+                auto c = rng() % centers.size();
+                pos = centers[c] + cv::Point2d(normal(rng), normal(rng)) * sigmas[c];
+            }
+            else if (pick < 0.85)
+            {
+                // 两个聚集中心之间的路径
+                auto a = centers[rng() % centers.size()];
+                auto b = centers[rng() % centers.size()];
+                pos = a + (b - a) * unit(rng) + cv::Point2d(normal(rng), normal(rng)) * 20.0;
+            }
+            else if (pick < 0.95 || items.empty())
+                pos = cv::Point2d(ux(rng), uy(rng));
+            else
+                pos = items[rng() % items.size()]->pos;
+            items.push_back(std::make_shared<ItemInface>(clamp(pos)));
+        }
+        return items;
+    }
+
+    cv::Rect random_rect(const cv::Rect &bound, int size, std::mt19937 &rng)
+    {
+        int x = bound.x + static_cast<int>(rng() % static_cast<uint32_t>(std::max(bound.width - size, 1)));
+        int y = bound.y + static_cast<int>(rng() % static_cast<uint32_t>(std::max(bound.height - size, 1)));
+        return cv::Rect(x, y, size, size);
+    }
+
+    // ------------------------------------------------------------------
+
+    void bench_tiles(const Options &options, Recorder &recorder)
+    {
+        std::mt19937 rng(options.seed);
+        auto tiles = make_tiles(options.grid, rng);
+        auto dir = std::filesystem::temp_directory_path() / ("block_map_benchmark_" + std::to_string(options.seed));
+        std::filesystem::create_directories(dir);
+        for (auto &[index, tile] : tiles)
+            cv::imwrite((dir / ("UI_Bench_" + std::to_string(index.x) + "_" + std::to_string(index.y) + ".png")).string(), tile);
+        auto pack_file = dir / "Bench.bmrp";
+        auto origin_index = tiles.empty() ? cv::Point(0, 0) : tiles[tiles.size() / 2].first;
+        auto tile_count = static_cast<int64_t>(tiles.size());
+        size_t load_repeat = options.quick ? 1 : 3;
+
+        recorder.add("load", "insert_memory", tile_count, measure(load_repeat, [&]
+                                                                   {
+            BlockMapResource resource;
+            for (auto &[index, tile] : tiles)
+                resource.insert(tile, index); }));
+        recorder.add("load", "eager_png", tile_count, measure(load_repeat, [&]
+                                                              { BlockMapResource resource(dir, "Bench", cv::Point(0, 0), origin_index); }));
+        recorder.add("load", "lazy_index", tile_count, measure(load_repeat, [&]
+                                                               { BlockMapResource resource(dir, "Bench", cv::Point(0, 0), origin_index, BlockMapResource::LoadMode::lazy); }));
+
+        BlockMapResource eager(dir, "Bench", cv::Point(0, 0), origin_index);
+        recorder.add("load", "save_packed", tile_count, measure(1, [&]
+                                                                { eager.save_packed(pack_file); }));
+        recorder.add("load", "mmap_packed", tile_count, measure(load_repeat, [&]
+                                                                { BlockMapResource resource(pack_file); }));
+
+        BlockMapResource packed(pack_file);
+        GrayBlockMapResource gray(dir, "Bench", cv::Point(0, 0), origin_index);
+        auto bound = eager.get_min_rect();
+        size_t checksum = 0;
+        std::vector<int> sizes = {64, 256, 1024, 2048, 4096};
+        if (options.quick == false)
+            sizes.push_back(8192);
+        for (auto size : sizes)
+        {
+            // 大范围合成耗时长，按像素数减少重复次数
+            size_t repeat = std::max<size_t>(options.repeat * 256 * 256 / std::max<size_t>(static_cast<size_t>(size) * size / 64, 256 * 256), 5);
+            std::mt19937 view_rng(options.seed + size);
+            recorder.add("view", "eager", size, measure(repeat, [&]
+                                                        { checksum += eager.view_abs(random_rect(bound, size, view_rng)).total(); }));
+            view_rng.seed(options.seed + size);
+            recorder.add("view", "mmap_packed", size, measure(repeat, [&]
+                                                              { checksum += packed.view_abs(random_rect(bound, size, view_rng)).total(); }));
+            view_rng.seed(options.seed + size);
+            recorder.add("view", "eager_gray", size, measure(repeat, [&]
+                                                             { checksum += gray.view_abs(random_rect(bound, size, view_rng)).total(); }));
+            view_rng.seed(options.seed + size);
+            recorder.add("view", "scaled_0.25", size, measure(repeat, [&]
+                                                              { checksum += eager.view_abs_scaled(random_rect(bound, size, view_rng), 0.25).total(); }));
+        }
+        // 旋转缩放到小地图尺寸：直接从区块采样，与先合成外扩范围再 warpAffine 比较
+        for (int size : {256, 1024})
+        {
+            cv::Size out_size(size, size);
+            double scale = 0.75;
+            std::mt19937 view_rng(options.seed + size);
+            recorder.add("view", "transformed", size, measure(options.repeat, [&]
+                                                               {
+                auto r = random_rect(bound, size * 2, view_rng);
+                checksum += eager.view_abs_transformed(cv::Point2d(r.x + size, r.y + size), 30, scale, out_size).total(); }));
+            view_rng.seed(options.seed + size);
+            recorder.add("view", "view_warp_affine", size, measure(options.repeat, [&]
+                                                                    {
+                auto r = random_rect(bound, size * 2, view_rng);
+                // 旋转任意角度都能覆盖输出的外扩范围
+                int half = static_cast<int>(std::ceil(size / scale * 0.75));
+                auto padded = eager.view_abs(cv::Rect(r.x + size - half, r.y + size - half, half * 2, half * 2));
+                cv::Mat rotation = cv::getRotationMatrix2D(cv::Point2f(static_cast<float>(half), static_cast<float>(half)), 30, scale);
+                rotation.at<double>(0, 2) += size / 2.0 - half;
+                rotation.at<double>(1, 2) += size / 2.0 - half;
+                cv::Mat m;
+                cv::warpAffine(padded, m, rotation, out_size);
+                checksum += m.total(); }));
+        }
+        {
+            BlockMapResource lazy(dir, "Bench", cv::Point(0, 0), origin_index, BlockMapResource::LoadMode::lazy);
+            std::mt19937 view_rng(options.seed);
+            recorder.add("view", "lazy_cold", 1024, measure(1, [&]
+                                                             { checksum += lazy.view_abs(random_rect(bound, 1024, view_rng)).total(); }));
+        }
+        // 沿对角线滑动的跟踪窗口，比较跨越区块边界时有无预取的延迟
+        for (bool prefetch : {false, true})
+        {
+            BlockMapResource lazy(dir, "Bench", cv::Point(0, 0), origin_index, BlockMapResource::LoadMode::lazy);
+            lazy.set_prefetch(prefetch);
+            int step = 0;
+            recorder.add("view", prefetch ? "lazy_slide_prefetch" : "lazy_slide", 256, measure(options.quick ? 200 : 1000, [&]
+                                                                                                   {
+                cv::Rect rect(bound.x + step * 8, bound.y + step * 8, 256, 256);
+                step = (step + 1) % std::max(1, std::min(bound.width, bound.height) / 8 - 32);
+                checksum += lazy.view_abs(rect).total(); }));
+        }
+        // 输出合成结果的像素总数，避免结果未被使用
+        std::cout << "view checksum: " << checksum << std::endl;
+        std::error_code error;
+        std::filesystem::remove_all(dir, error);
+    }
+
+    void bench_items(const Options &options, Recorder &recorder)
+    {
+        cv::Rect2d rect(-8192, -8192, 16384, 16384);
+        std::vector<size_t> counts = {1000, 10000};
+        if (options.quick == false)
+            counts.push_back(100000);
+        for (auto distribution : {Distribution::uniform, Distribution::clustered, Distribution::realistic})
+            for (auto count : counts)
+            {
+                std::mt19937 rng(options.seed + static_cast<uint32_t>(count));
+                auto items = make_items(distribution, count, rect, rng);
+                std::string name = to_string(distribution);
+                auto size = static_cast<int64_t>(count);
+                recorder.add("item_build", name, size, measure(options.quick ? 1 : 5, [&]
+                                                               { ItemSetTree tree(rect, items); }));
+                ItemSetTree tree(rect, items);
+                auto tree_file = std::filesystem::temp_directory_path() / ("item_tree_benchmark_" + std::to_string(options.seed) + ".bin");
+                if (tree.save(tree_file))
+                    recorder.add("item_open", name, size, measure(options.quick ? 1 : 5, [&]
+                                                                  { ItemSetTree mapped;
+                                                                    mapped.open(tree_file, items); }));
+                std::error_code error;
+                std::filesystem::remove(tree_file, error);
+                cv::Rect bound(rect);
+                for (int query : {500, 2000, 8000})
+                {
+                    std::mt19937 query_rng(options.seed + query);
+                    recorder.add("item_find", name + "_" + std::to_string(query), size, measure(options.repeat, [&]
+                                                                                                { auto found = tree.find(random_rect(bound, query, query_rng)); }));
+                }
+                std::mt19937 visit_rng(options.seed + 2000);
+                size_t visited = 0;
+                recorder.add("item_visit", name + "_2000", size, measure(options.repeat, [&]
+                                                                          { tree.visit(random_rect(bound, 2000, visit_rng), [&](const std::shared_ptr<ItemInface> &)
+                                                                                       { visited++; }); }));
+                std::mt19937 count_rng(options.seed + 2000);
+                recorder.add("item_count", name + "_2000", size, measure(options.repeat, [&]
+                                                                          { visited += tree.count(random_rect(bound, 2000, count_rng)); }));
+                std::mt19937 batch_rng(options.seed + 2000);
+                std::vector<cv::Rect2d> batch(1000);
+                recorder.add("item_batch", name + "_2000x1000", size, measure(options.repeat, [&]
+                                                                               {
+                    for (auto &r : batch)
+                        r = random_rect(bound, 2000, batch_rng);
+                    auto found = tree.find_batch(batch); }));
+                std::uniform_real_distribution<double> coord(-8192, 8192);
+                std::mt19937 near_rng(options.seed);
+                for (size_t k : {1, 16})
+                    recorder.add("item_nearest", name + "_k" + std::to_string(k), size, measure(options.repeat, [&]
+                                                                                                  { auto found = tree.nearest({coord(near_rng), coord(near_rng)}, k); }));
+                recorder.add("item_within", name + "_500", size, measure(options.repeat, [&]
+                                                                          { auto found = tree.within({coord(near_rng), coord(near_rng)}, 500); }));
+                for (double cell : {64.0, 512.0})
+                    recorder.add("item_clusters", name + "_" + std::to_string(static_cast<int>(cell)), size, measure(options.repeat, [&]
+                                                                                                                       { auto clusters = tree.find_clusters(rect, cell); }));
+                std::mt19937 move_rng(options.seed);
+                std::normal_distribution<double> step(0, 64);
+                recorder.add("item_move", name + "_1000", size, measure(options.repeat, [&]
+                                                                         {
+                    for (int i = 0; i < 1000; i++)
+                    {
+                        auto &item = items[move_rng() % items.size()];
+                        tree.move(item, item->pos + cv::Point2d(step(move_rng), step(move_rng)));
+                    } }));
+                std::mt19937 query_rng(options.seed);
+                recorder.add("item_childs", name + "_2000", size, measure(options.repeat, [&]
+                                                                           { auto nodes = tree.find_childs(random_rect(bound, 2000, query_rng)); }));
+            }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    std::vector<std::string> args(argv + 1, argv + argc);
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        bool has_value = i + 1 < args.size();
+        if (args[i] == "--grid" && has_value)
+            options.grid = std::max(std::stoi(args[++i]), 1);
+        else if (args[i] == "--seed" && has_value)
+            options.seed = static_cast<uint32_t>(std::stoul(args[++i]));
+        else if (args[i] == "--repeat" && has_value)
+            options.repeat = std::max<size_t>(std::stoul(args[++i]), 1);
+        else if (args[i] == "--json" && has_value)
+            options.json_file = args[++i];
+        else if (args[i] == "--quick")
+        {
+            options.quick = true;
+            options.grid = std::min(options.grid, 4);
+            options.repeat = std::min<size_t>(options.repeat, 20);
+        }
+        else
+        {
+            std::cout << "usage: benchmark [--grid N] [--seed S] [--repeat R] [--json output_file] [--quick]" << std::endl;
+            return 1;
+        }
+    }
+
+    Recorder recorder;
+    Recorder::print_header();
+    bench_tiles(options, recorder);
+    bench_items(options, recorder);
+    if (options.json_file.empty() == false && recorder.save(options.json_file, options) == false)
+    {
+        std::cout << "write failed: " << options.json_file << std::endl;
+        return 1;
+    }
+    return 0;
+}
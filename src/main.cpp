@@ -1,7 +1,11 @@
 #include <iostream>
 #include "BlockMapResource.h"
 #include "MapItemSet.h"
+#include "MapBatchBuilder.h"
+#include "MapFeatureBuilder.h"
+#include "BuildManifest.h"
 
+#ifdef _WIN32
 #include <Windows.h>
 std::string utf8_to_gbk(const std::string &src)
 {
@@ -19,6 +23,7 @@ std::string utf8_to_gbk(const std::string &src)
     WideCharToMultiByte(CP_ACP, 0, wstr.get(), -1, str.get(), len, NULL, NULL);
     return std::string(str.get());
 }
+#endif
 
 void test_quadTree(BlockMapResource &q, int x, int y, int w, int h)
 {
@@ -28,7 +33,8 @@ void test_quadTree(BlockMapResource &q, int x, int y, int w, int h)
     cv::waitKey(100);
 }
 
-void save_quadTree(BlockMapResource &q)
+// 返回整图是否导出成功
+bool save_quadTree(BlockMapResource &q)
 {
 
     {
@@ -42,16 +48,18 @@ void save_quadTree(BlockMapResource &q)
     }
     auto start = std::chrono::steady_clock::now();
 
-    cv::Mat map = q.view();
+    // 按条带流式导出，不在内存中合成整图
+    bool exported = q.export_ppm("AllMap.ppm");
+    if (exported == false)
+        std::cout << "write failed: AllMap.ppm" << std::endl;
 
     auto end = std::chrono::steady_clock::now();
     std::chrono::duration<double> diff = end - start;
-    std::cout << "view: " << diff.count() << " s" << std::endl;
-    cv::imwrite("AllMap.png", map);
-    cv::Mat mini_map;
+    std::cout << "export: " << diff.count() << " s" << std::endl;
     double f = 600.0 / 2048.0 * 2;
-    cv::resize(map, mini_map, cv::Size(), f, f, cv::INTER_NEAREST);
+    cv::Mat mini_map = q.view_abs_scaled(q.get_min_rect(), f, cv::INTER_NEAREST);
     cv::imwrite("AllMap_mini.png", mini_map);
+    return exported;
 }
 
 void test_1st()
@@ -96,21 +104,52 @@ void test()
 {
     std::filesystem::path maps_data_path("C:/Users/XiZhu/Desktop/data");
 
-    std::map<std::string, cv::Mat> maps;
-    for (auto &p : std::filesystem::directory_iterator(maps_data_path))
+    // 所有地图并发构建，总内存不超过 8GB，每张地图写出后立即释放
+    // 区块未变化的地图复用上次的输出
+    BuildManifest manifest("build.manifest");
+    MapBatchBuilder builder(8ull * 1024 * 1024 * 1024);
+    auto reports = builder.run(MapBatchBuilder::scan(maps_data_path, "."), &manifest);
+    manifest.save("build.manifest");
+    MapBatchBuilder::print(reports);
+}
+
+void test_features()
+{
+    auto start = std::chrono::steady_clock::now();
+    // 按区块内容哈希增量重建，只重新处理变化的区块
+    BuildManifest manifest("build.manifest");
+    auto tiles = BlockMapResource::scan("../../src/map/", "MapBack");
+    auto changes = manifest.update_tiles("MapBack", tiles);
+    std::cout << "changed tiles: " << changes.changed.size() << " / " << tiles.size() << std::endl;
+
+    BlockMapResource quadTree("../../src/map/", "MapBack", cv::Point(232, 216), cv::Point(-1, 0), BlockMapResource::LoadMode::lazy);
+    if (manifest.up_to_date("AllMap", changes.hash, "AllMap.ppm") == false)
+    {
+        manifest.invalidate("AllMap");
+        if (save_quadTree(quadTree))
+            manifest.record("AllMap", changes.hash);
+    }
+
+    MapFeatureBuilder builder;
+    // 特征还取决于检测器、扩展像素数与地图原点，与区块哈希一起作为输入哈希
+    auto inputs = builder.input_hash(quadTree, changes.hash);
+    if (manifest.up_to_date("MapBack.features", inputs, "MapBack.features") == false)
     {
-        if (p.path().filename().string().find("UI_Map") == std::string::npos)
-            continue;
-        // std::cout << p.path() << std::endl;
-        auto textures_path = p.path() / "Texture2D";
-        if (std::filesystem::exists(textures_path) == false)
-            continue;
-        auto map_name = p.path().filename().string().substr(3, p.path().filename().string().size() - 3 - 1);
-        std::cout << map_name << std::endl;
-        BlockMapResource mr(textures_path, map_name, cv::Point(0, 0), cv::Point(0, 0));
-        maps[map_name] = mr.view();
-        cv::imwrite(map_name + ".png", maps[map_name]);
+        // 只有由上次区块以相同参数生成、且能完整读取的特征文件才能按区块复用，否则全部重建
+        std::optional<MapFeatureBuilder::Result> previous;
+        if (changes.previous_hash && manifest.up_to_date("MapBack.features", builder.input_hash(quadTree, changes.previous_hash.value()), "MapBack.features"))
+            previous = MapFeatureBuilder::load("MapBack.features");
+        auto features = previous ? builder.build(quadTree, previous.value(), changes.changed) : builder.build(quadTree);
+        manifest.invalidate("MapBack.features");
+        if (MapFeatureBuilder::save("MapBack.features", features))
+            manifest.record("MapBack.features", inputs);
+        std::cout << "features: " << features.keypoints.size() << std::endl;
     }
+    manifest.save("build.manifest");
+
+    auto end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> diff = end - start;
+    std::cout << "incremental build: " << diff.count() << " s" << std::endl;
 }
 
 void test_2()
@@ -143,9 +182,124 @@ void test_2()
         std::chrono::milliseconds diff = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
         std::cout << "view: " << diff.count() << " ms" << std::endl;
     }
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<cv::Rect2d> rects;
+        for (int i = 0; i < 1000; i++)
+            rects.push_back(cv::Rect2d(-1000, i, 2000, 2000));
+        auto result = tree.find_batch(rects);
+        auto end = std::chrono::steady_clock::now();
+        std::chrono::milliseconds diff = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+        std::cout << "batch view: " << diff.count() << " ms" << std::endl;
+    }
     tree.print();
 }
 
+#include <random>
+// 随机插入、移动与删除后，与逐个遍历全部物品的结果比较范围查询和最近邻
+// 移动到根节点范围之外会扩大根节点，大量删除会触发子树合并与整理
+bool test_item_mutation()
+{
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> coord(-4000, 4000);
+    std::uniform_real_distribution<double> far(-20000, 20000);
+    std::vector<std::shared_ptr<ItemInface>> items;
+    for (int i = 0; i < 5000; i++)
+        items.push_back(std::make_shared<ItemObject>(cv::Point2d(coord(rng), coord(rng)), "name" + std::to_string(i)));
+    ItemSetTree tree(cv::Rect2d(-4096, -4096, 8192, 8192), items);
+    std::vector<std::shared_ptr<ItemInface>> live = items;
+
+    auto check = [&](int step)
+    {
+        if (tree.size() != live.size())
+        {
+            std::cout << "step " << step << ": size " << tree.size() << " != " << live.size() << std::endl;
+            return false;
+        }
+        for (int q = 0; q < 20; q++)
+        {
+            double w = q % 2 ? 6000 : 300;
+            cv::Rect2d rect(far(rng) / 2, far(rng) / 2, w, w * 0.7);
+            auto found = tree.find(rect);
+            std::set<ItemInface *> expected, actual;
+            for (auto &item : live)
+                if (rect.contains(item->pos))
+                    expected.insert(item.get());
+            for (auto &item : found)
+                actual.insert(item.get());
+            if (expected != actual || found.size() != actual.size())
+            {
+                std::cout << "step " << step << ": find " << found.size() << " != " << expected.size() << std::endl;
+                return false;
+            }
+            cv::Point2d pos(far(rng) / 2, far(rng) / 2);
+            size_t k = q % 3 == 0 ? 1 : 16;
+            std::vector<double> brute;
+            for (auto &item : live)
+                brute.push_back(cv::norm(item->pos - pos));
+            std::sort(brute.begin(), brute.end());
+            brute.resize(std::min(k, brute.size()));
+            auto near = tree.nearest(pos, k);
+            if (near.size() != brute.size())
+            {
+                std::cout << "step " << step << ": nearest " << near.size() << " != " << brute.size() << std::endl;
+                return false;
+            }
+            // 距离相同的物品顺序不定，只比较距离
+            for (size_t i = 0; i < near.size(); i++)
+                if (std::abs(cv::norm(near[i]->pos - pos) - brute[i]) > 1e-9)
+                {
+                    std::cout << "step " << step << ": nearest distance mismatch at " << i << std::endl;
+                    return false;
+                }
+        }
+        return true;
+    };
+
+    std::uniform_int_distribution<int> action(0, 9);
+    for (int step = 0; step < 20000; step++)
+    {
+        auto a = action(rng);
+        if ((a < 3 || live.empty()) && step < 15000)
+        {
+            // 少量插入到根节点范围之外
+            auto item = std::make_shared<ItemObject>(cv::Point2d(a == 0 ? far(rng) : coord(rng), coord(rng)), "inserted");
+            if (tree.insert(item))
+                live.push_back(item);
+        }
+        else if (a < 7 && live.empty() == false)
+        {
+            auto &item = live[std::uniform_int_distribution<size_t>(0, live.size() - 1)(rng)];
+            // 大多数移动距离较小，留在原叶子或相邻叶子
+            cv::Point2d pos = a == 3 ? cv::Point2d(far(rng), far(rng)) : item->pos + cv::Point2d(coord(rng) / 100, coord(rng) / 100);
+            if (tree.move(item, pos) == false)
+            {
+                std::cout << "step " << step << ": move failed" << std::endl;
+                return false;
+            }
+        }
+        else if (live.empty() == false)
+        {
+            // 后段只删除，子树物品数下降后合并
+            auto index = std::uniform_int_distribution<size_t>(0, live.size() - 1)(rng);
+            if (tree.remove(live[index]) == false)
+            {
+                std::cout << "step " << step << ": remove failed" << std::endl;
+                return false;
+            }
+            live[index] = live.back();
+            live.pop_back();
+        }
+        if (step % 1000 == 999 && check(step) == false)
+            return false;
+    }
+    tree.compact();
+    if (check(-1) == false)
+        return false;
+    std::cout << "item mutation: ok, " << live.size() << " items" << std::endl;
+    return true;
+}
+
 #include <algorithm>
 #include <math.h>
 void test__()
@@ -174,7 +328,7 @@ void test__()
     auto map = quadTree.view();
     for (auto &node : result)
     {
-        for (auto &item : node->items)
+        for (auto &item : tree.node_items(*node))
         {
             auto item_pos = item->pos - cv::Point2d(-max_radius_int, -max_radius_int);
             cv::circle(map, item_pos, 5, cv::Scalar(0, 0, 255), -1);
@@ -188,10 +342,9 @@ void test__()
 
 #include <meojson/include/json.hpp>
 std::vector<cv::Point2d> from_json(std::string json_file);
-std::vector<cv::Point2d> from_txt()
+std::vector<std::string> item_paths()
 {
-    std::vector<cv::Point2d> points;
-    std::vector<std::string> paths = {
+    return {
         "../../src/item/0.json",
         "../../src/item/1.json",
         "../../src/item/2.json",
@@ -208,7 +361,11 @@ std::vector<cv::Point2d> from_txt()
         "../../src/item/13.json",
         "../../src/item/14.json",
         "../../src/item/15.json"};
-    for (auto &path : paths)
+}
+std::vector<cv::Point2d> from_txt()
+{
+    std::vector<cv::Point2d> points;
+    for (auto &path : item_paths())
     {
         auto point = from_json(path);
         // merge
@@ -220,9 +377,12 @@ std::vector<cv::Point2d> from_txt()
 #include <fstream>
 std::vector<cv::Point2d> from_json(std::string json_file)
 {
+    TraceScope scope("parse", "json");
     std::vector<cv::Point2d> points;
     std::ifstream in(json_file);
     std::string str((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    scope.bytes(static_cast<int64_t>(str.size()));
+    BuildTrace::add(TraceCounter::bytes_read, static_cast<int64_t>(str.size()));
     auto json_res = json::parse(str);
     if (json_res.has_value() == false)
     {
@@ -240,6 +400,7 @@ std::vector<cv::Point2d> from_json(std::string json_file)
         double y = std::stod(position_str.substr(position_str.find(",") + 1));
         points.push_back(cv::Point2d(x, y));
     }
+    scope.items(static_cast<int64_t>(points.size()));
 
     return points;
 }
@@ -261,30 +422,79 @@ cv::Rect2d get_max_rect(BlockMapResource &quadTree)
 }
 int main(int argc, char *argv[])
 {
-    auto points = from_txt();
-    std::vector<std::shared_ptr<ItemInface>> items;
-    for (int i = 0; i < points.size(); i++)
-        items.push_back(std::make_shared<ItemObject>(points[i], "name" + std::to_string(i)));
+    // --trace <文件> 记录各阶段耗时，结束时导出 Chrome trace 并输出汇总表
+    // --items <文件> 物品索引缓存，清单中记录的 json 内容哈希未变化且文件有效时直接映射，否则解析 json 建立后写入
+    // --check-items 只运行四叉树增删移动的正确性检查，返回值表示是否通过
+    for (int i = 1; i < argc; i++)
+        if (std::string(argv[i]) == "--check-items")
+            return test_item_mutation() ? 0 : 1;
+    std::filesystem::path trace_file;
+    std::filesystem::path item_file;
+    for (int i = 1; i + 1 < argc; i++)
+        if (std::string(argv[i]) == "--trace")
+            trace_file = argv[i + 1];
+        else if (std::string(argv[i]) == "--items")
+            item_file = argv[i + 1];
+    if (trace_file.empty() == false)
+        BuildTrace::enable();
 
     BlockMapResource quadTree("../../src/map/", "MapBack", cv::Point(232, 216), cv::Point(-1, 0));
     auto map_center = quadTree.get_abs_origin();
     auto max_rect = get_max_rect(quadTree); // cv::Rect2d(quadTree.get_min_rect());
     auto origin = cv::Rect2d(quadTree.get_min_rect()).tl() - cv::Point2d(map_center);
 
-    ItemSetTree tree(max_rect, items);
+    // 缓存的输入为全部 json 的内容与根节点范围，有不可读的 json 时不复用也不记录
+    BuildManifest manifest("build.manifest");
+    auto artifact = item_file.filename().string();
+    auto inputs = BuildManifest::hash_bytes(&max_rect, sizeof(max_rect));
+    bool readable = true;
+    for (auto &path : item_paths())
+    {
+        auto hash = BuildManifest::hash_file(path);
+        readable = readable && hash.has_value();
+        inputs = BuildManifest::combine(inputs, hash.value_or(0));
+    }
+    // 从缓存打开时不解析 json，物品项只有保存的位置（ItemInface），没有重新建立时 ItemObject 的名称等信息；
+    // 下面只用到节点与聚类，两种方式结果相同，需要名称时应解析 json 后通过 open 的 items 参数传入
+    ItemSetTree tree;
+    if (item_file.empty() || readable == false || manifest.up_to_date(artifact, inputs, item_file) == false || tree.open(item_file) == false)
+    {
+        auto points = from_txt();
+        std::vector<std::shared_ptr<ItemInface>> items;
+        for (int i = 0; i < points.size(); i++)
+            items.push_back(std::make_shared<ItemObject>(points[i], "name" + std::to_string(i)));
+        tree.build(max_rect, items);
+        if (item_file.empty() == false)
+        {
+            manifest.invalidate(artifact);
+            if (tree.save(item_file) == false)
+                std::cout << "write failed: " << item_file << std::endl;
+            else if (readable)
+                manifest.record(artifact, inputs);
+            manifest.save("build.manifest");
+        }
+    }
     auto result = tree.find_childs(max_rect);
     auto map_r = quadTree.view(cv::Rect2d(-100, -100, 200, 200));
     auto map = quadTree.view();
+    auto scale = 1.5;
     for (auto &node : result)
     {
-        auto scale = 1.5;
-        for (auto &item : node->items)
-        {
-            auto item_pos = item->pos * scale - origin;
-            cv::circle(map, item_pos, 10, cv::Scalar(0, 0, 255), 4);
-        }
         auto node_rect = cv::Rect2d(node->rect.tl() * scale - origin, cv::Size2d(node->rect.width * scale, node->rect.height * scale));
         cv::rectangle(map, node_rect, cv::Scalar(0, 255, 0), 1);
     }
+    // 整张地图缩小显示，同一单元内的物品合并为一个圆，半径随数量增大
+    for (auto &cluster : tree.find_clusters(max_rect, 64))
+    {
+        auto item_pos = cluster.center * scale - origin;
+        auto radius = static_cast<int>(10 + 4 * std::log2(static_cast<double>(cluster.count)));
+        cv::circle(map, item_pos, radius, cv::Scalar(0, 0, 255), 4);
+    }
+    if (trace_file.empty() == false)
+    {
+        BuildTrace::print();
+        if (BuildTrace::save(trace_file) == false)
+            std::cout << "write failed: " << trace_file << std::endl;
+    }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,42 @@
+#include <chrono>
+#include <iostream>
+#include "BlockMapResource.h"
+
+// 将地图区块目录打包为单个可内存映射的区块文件
+// 用法: pack_tiles <区块目录> <地图名> <输出文件> [map_origin_x map_origin_y origin_index_x origin_index_y] [--png]
+// 例如: pack_tiles ../../src/map/ MapBack MapBack.bmrp 232 216 -1 0
+int main(int argc, char *argv[])
+{
+    if (argc < 4)
+    {
+        std::cout << "usage: pack_tiles <tiles_dir> <map_name> <output_file> [map_origin_x map_origin_y origin_index_x origin_index_y] [--png]" << std::endl;
+        return 1;
+    }
+    std::vector<std::string> args(argv + 1, argv + argc);
+    auto encoding = PackedTileEncoding::raw;
+    if (auto it = std::find(args.begin(), args.end(), "--png"); it != args.end())
+    {
+        encoding = PackedTileEncoding::png;
+        args.erase(it);
+    }
+    cv::Point map_origin(0, 0);
+    cv::Point origin_index(0, 0);
+    if (args.size() >= 7)
+    {
+        map_origin = cv::Point(std::stoi(args[3]), std::stoi(args[4]));
+        origin_index = cv::Point(std::stoi(args[5]), std::stoi(args[6]));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    // 延迟加载模式逐个区块读取写出，打包过程不会同时持有全部区块
+    BlockMapResource resource(args[0], args[1], map_origin, origin_index, BlockMapResource::LoadMode::lazy);
+    if (resource.save_packed(args[2], encoding) == false)
+    {
+        std::cout << "write failed: " << args[2] << std::endl;
+        return 1;
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> diff = end - start;
+    std::cout << "pack: " << diff.count() << " s" << std::endl;
+    return 0;
+}